@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <stdalign.h>
+#include "arena.h"
+#include "stats.h"
+
+#define ARENA_ALIGNMENT alignof(max_align_t)
+
+size_t alignArenaSize(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+char* getArenaBlockData(ArenaBlock* block) {
+    return (char*) block + alignArenaSize(sizeof(ArenaBlock));
+}
+
+ArenaBlock* createArenaBlock(size_t capacity) {
+    ArenaBlock* block = (ArenaBlock*) malloc(alignArenaSize(sizeof(ArenaBlock)) + capacity);
+    STATS_ALLOCATION(alignArenaSize(sizeof(ArenaBlock)) + capacity);
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+void initArena(Arena* arena, size_t blockSize) {
+    arena->first = createArenaBlock(blockSize);
+    arena->current = arena->first;
+    arena->blockSize = blockSize;
+}
+
+// Following blocks are reused if they are big enough, otherwise a new block is put before them
+void* arenaAlloc(Arena* arena, size_t size) {
+    size = alignArenaSize(size);
+    ArenaBlock* block = arena->current;
+    if(block->used + size > block->capacity) {
+        ArenaBlock* next = block->next;
+        if(next == NULL || next->capacity < size) {
+            next = createArenaBlock(size > arena->blockSize ? size : arena->blockSize);
+            next->next = block->next;
+            block->next = next;
+        }
+        next->used = 0;
+        arena->current = next;
+        block = next;
+    }
+
+    void* result = getArenaBlockData(block) + block->used;
+    block->used += size;
+    return result;
+}
+
+ArenaMark getArenaMark(Arena* arena) {
+    ArenaMark mark = {arena->current, arena->current->used};
+    return mark;
+}
+
+// Everything allocated after the mark was taken is released at once
+void resetArenaToMark(Arena* arena, ArenaMark mark) {
+    arena->current = mark.block;
+    arena->current->used = mark.used;
+}
+
+void resetArena(Arena* arena) {
+    arena->current = arena->first;
+    arena->current->used = 0;
+}
+
+void freeArena(Arena* arena) {
+    ArenaBlock* block = arena->first;
+    while(block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef CBATTLESHIPS_ARENA_H
+#define CBATTLESHIPS_ARENA_H
+
+#include <stddef.h>
+
+// Block of an arena, its memory follows the header
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t capacity;
+    size_t used;
+} ArenaBlock;
+
+/* Bump allocator, memory is given back only all at once or down to a mark. Blocks are kept
+ * after a reset, so an arena which is reset regularly stops calling malloc once warmed up. */
+typedef struct {
+    ArenaBlock* first;
+    ArenaBlock* current;
+    size_t blockSize;
+} Arena;
+
+typedef struct {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+void initArena(Arena* arena, size_t blockSize);
+void* arenaAlloc(Arena* arena, size_t size);
+ArenaMark getArenaMark(Arena* arena);
+void resetArenaToMark(Arena* arena, ArenaMark mark);
+void resetArena(Arena* arena);
+void freeArena(Arena* arena);
+
+#endif //CBATTLESHIPS_ARENA_H
@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+#include "batchqueue.h"
+
+void initLineBatch(LineBatch* batch) {
+    batch->data = NULL;
+    batch->length = 0;
+    batch->capacity = 0;
+}
+
+void appendLineToBatch(LineBatch* batch, const char* line, size_t length) {
+    if(batch->length + length + 1 > batch->capacity) {
+        size_t newCapacity = batch->capacity * 2;
+        if(newCapacity < batch->length + length + 1) newCapacity = batch->length + length + 1;
+        batch->data = (char*) realloc(batch->data, newCapacity);
+        batch->capacity = newCapacity;
+    }
+    memcpy(batch->data + batch->length, line, length);
+    batch->length += length;
+    batch->data[batch->length++] = '\0';
+}
+
+void freeLineBatch(LineBatch* batch) {
+    free(batch->data);
+    initLineBatch(batch);
+}
+
+void initBatchQueue(BatchQueue* queue, int capacity) {
+    queue->batches = (LineBatch*) malloc(capacity * sizeof(LineBatch));
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->isClosed = 0;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+}
+
+// Queue takes over the memory of the batch, which is left empty
+void pushBatch(BatchQueue* queue, LineBatch* batch) {
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->count == queue->capacity) {
+        pthread_cond_wait(&queue->notFull, &queue->mutex);
+    }
+    queue->batches[(queue->head + queue->count) % queue->capacity] = *batch;
+    queue->count++;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->mutex);
+    initLineBatch(batch);
+}
+
+// Returns 0 once the queue is closed and all its batches were taken
+int popBatch(BatchQueue* queue, LineBatch* batch) {
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->count == 0 && !queue->isClosed) {
+        pthread_cond_wait(&queue->notEmpty, &queue->mutex);
+    }
+    int hasBatch = queue->count > 0;
+    if(hasBatch) {
+        *batch = queue->batches[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->notFull);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return hasBatch;
+}
+
+void closeBatchQueue(BatchQueue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+    queue->isClosed = 1;
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Batches still in the queue are freed as well
+void freeBatchQueue(BatchQueue* queue) {
+    for(int batchI = 0; batchI < queue->count; batchI++) {
+        freeLineBatch(&queue->batches[(queue->head + batchI) % queue->capacity]);
+    }
+    free(queue->batches);
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_cond_destroy(&queue->notFull);
+}
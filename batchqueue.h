@@ -0,0 +1,36 @@
+#ifndef CBATTLESHIPS_BATCHQUEUE_H
+#define CBATTLESHIPS_BATCHQUEUE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// Lines handed over between threads at once, every line is terminated with '\0'
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} LineBatch;
+
+// Bounded FIFO of batches, producer waits while it is full and consumer while it is empty
+typedef struct {
+    LineBatch* batches;
+    int capacity;
+    int head;
+    int count;
+    int isClosed;
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+} BatchQueue;
+
+void initLineBatch(LineBatch* batch);
+void appendLineToBatch(LineBatch* batch, const char* line, size_t length);
+void freeLineBatch(LineBatch* batch);
+
+void initBatchQueue(BatchQueue* queue, int capacity);
+void pushBatch(BatchQueue* queue, LineBatch* batch);
+int popBatch(BatchQueue* queue, LineBatch* batch);
+void closeBatchQueue(BatchQueue* queue);
+void freeBatchQueue(BatchQueue* queue);
+
+#endif //CBATTLESHIPS_BATCHQUEUE_H
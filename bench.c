@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "benchgen.h"
+#include "engine.h"
+#include "reader.h"
+#include "strmap.h"
+#include "vectors.h"
+
+#define BENCH_KIND_NAME_SIZE 32
+#define BENCH_MAX_SHIPS (1 << 16)
+
+/* ===========================================
+ * Benchmark of the engine on generated games
+ * ===========================================*/
+
+DECLARE_VEC(LineVec, char*, lineVec)
+DEFINE_VEC(LineVec, char*, lineVec)
+DECLARE_VEC(LatencyVec, uint64_t, latencyVec)
+DEFINE_VEC(LatencyVec, uint64_t, latencyVec)
+
+typedef struct {
+    int shouldGenerate;
+    const char* scriptPath;
+    int repeatsCount;
+    BenchScriptOptions script;
+} BenchOptions;
+
+void printBenchUsage(FILE* out);
+int parseBenchInts(int argc, char** argv, int* argI, int* values, int count, int min, int max);
+int parseBenchOptions(BenchOptions* options, int argc, char** argv);
+int loadBenchScript(BenchOptions* options, LineVec* lines);
+uint64_t getBenchNanos();
+void getLineKind(const char* line, char* kind);
+void recordLatency(StringMap* kinds, const char* kind, uint64_t nanos);
+int runBenchScript(LineVec* lines, StringMap* kinds, uint64_t* totalNanos);
+int compareLatencies(const void* first, const void* second);
+uint64_t getPercentile(LatencyVec* latencies, int percent);
+void printBenchReport(FILE* out, StringMap* kinds, uint64_t totalNanos);
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if(!parseBenchOptions(&options, argc, argv)) {
+        printBenchUsage(stderr);
+        return 2;
+    }
+
+    if(options.shouldGenerate) {
+        if(!generateBenchScript(&options.script, stdout)) {
+            fprintf(stderr, "fleet does not fit on the board\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    LineVec lines;
+    initLineVec(&lines);
+    if(!loadBenchScript(&options, &lines)) return 1;
+
+    // Engine writes its output to stdout, the report goes to where stdout pointed before
+    FILE* report = fdopen(dup(STDOUT_FILENO), "w");
+    if(report == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "cannot redirect the output of the engine\n");
+        return 1;
+    }
+
+    StringMap kinds;
+    initStringMap(&kinds);
+    uint64_t totalNanos = 0;
+    int result = 0;
+    for(int repeatI = 0; repeatI < options.repeatsCount; repeatI++) {
+        if(!runBenchScript(&lines, &kinds, &totalNanos)) result = 1;
+    }
+    printBenchReport(report, &kinds, totalNanos);
+    fclose(report);
+
+    for(int kindI = 0; kindI < kinds.length; kindI++) {
+        freeLatencyVec((LatencyVec*) kinds.values[kindI]);
+        free(kinds.values[kindI]);
+    }
+    freeStringMap(&kinds);
+    VEC_FOR_EACH(char*, line, &lines) free(*line);
+    freeLineVec(&lines);
+    return result;
+}
+
+void printBenchUsage(FILE* out) {
+    fprintf(out,
+            "usage: cbattleships_bench [--generate | --script PATH] [--repeat N] [options]\n"
+            "  --generate          print the generated script instead of running it\n"
+            "  --script PATH       run commands from the file instead of a generated script\n"
+            "  --repeat N          run the script N times, every time as a new game\n"
+            "generator options:\n"
+            "  --seed N            seed of the generator\n"
+            "  --board Y X         size of the board\n"
+            "  --fleet C B R D     carriers, battleships, cruisers and destroyers of each player\n"
+            "  --reefs PERCENT     part of fields with reefs\n"
+            "  --turns N           number of turns after placing the fleets\n"
+            "  --moves N           MOVE commands of a turn at most\n"
+            "  --shots N           SHOOT commands of a turn at most (1 in the basic mode)\n"
+            "  --spies N           SPY commands of a turn at most\n"
+            "  --prints N          PRINT commands of a turn\n"
+            "  --extended          extended ships\n");
+}
+
+// Reads count integers following argument argI, returns 0 if they are missing or out of [min, max]
+int parseBenchInts(int argc, char** argv, int* argI, int* values, int count, int min, int max) {
+    if(*argI + count >= argc) return 0;
+    for(int valueI = 0; valueI < count; valueI++) {
+        char* end;
+        long value = strtol(argv[++*argI], &end, 10);
+        if(*end != '\0' || value < min || value > max) return 0;
+        values[valueI] = (int) value;
+    }
+    return 1;
+}
+
+// Returns 0 if the arguments are wrong
+int parseBenchOptions(BenchOptions* options, int argc, char** argv) {
+    options->shouldGenerate = 0;
+    options->scriptPath = NULL;
+    options->repeatsCount = 1;
+    BenchScriptOptions* script = &options->script;
+    initBenchScriptOptions(script);
+
+    for(int argI = 1; argI < argc; argI++) {
+        const char* arg = argv[argI];
+        int isRight = 1;
+        if(strcmp(arg, "--generate") == 0) {
+            options->shouldGenerate = 1;
+        } else if(strcmp(arg, "--script") == 0 && argI + 1 < argc) {
+            options->scriptPath = argv[++argI];
+        } else if(strcmp(arg, "--repeat") == 0) {
+            isRight = parseBenchInts(argc, argv, &argI, &options->repeatsCount, 1, 1, 1000000);
+        } else if(strcmp(arg, "--seed") == 0 && argI + 1 < argc) {
+            char* end;
+            script->seed = strtoull(argv[++argI], &end, 10);
+            isRight = *end == '\0';
+        } else if(strcmp(arg, "--board") == 0) {
+            int size[2];
+            isRight = parseBenchInts(argc, argv, &argI, size, 2, 2, 1 << 15);
+            if(isRight) script->sizeY = size[0], script->sizeX = size[1];
+        } else if(strcmp(arg, "--fleet") == 0) {
+            isRight = parseBenchInts(argc, argv, &argI, script->fleet, BENCH_CLASSES_COUNT, 0, BENCH_MAX_SHIPS);
+        } else if(strcmp(arg, "--reefs") == 0) {
+            isRight = parseBenchInts(argc, argv, &argI, &script->reefsPercent, 1, 0, 100);
+        } else if(strcmp(arg, "--turns") == 0) {
+            isRight = parseBenchInts(argc, argv, &argI, &script->turnsCount, 1, 0, 1 << 30);
+        } else if(strcmp(arg, "--moves") == 0) {
+            isRight = parseBenchInts(argc, argv, &argI, &script->movesPerTurn, 1, 0, 1 << 10);
+        } else if(strcmp(arg, "--shots") == 0) {
+            isRight = parseBenchInts(argc, argv, &argI, &script->shotsPerTurn, 1, 0, 1 << 10);
+        } else if(strcmp(arg, "--spies") == 0) {
+            isRight = parseBenchInts(argc, argv, &argI, &script->spiesPerTurn, 1, 0, 1 << 10);
+        } else if(strcmp(arg, "--prints") == 0) {
+            isRight = parseBenchInts(argc, argv, &argI, &script->printsPerTurn, 1, 0, 1 << 10);
+        } else if(strcmp(arg, "--extended") == 0) {
+            script->extendedShips = 1;
+        } else {
+            isRight = 0;
+        }
+        if(!isRight) return 0;
+    }
+
+    // Game without ships would be won right after placing them
+    int shipsCount = 0;
+    for(int classI = 0; classI < BENCH_CLASSES_COUNT; classI++) shipsCount += script->fleet[classI];
+    return shipsCount > 0;
+}
+
+// Whole script is read before running it, so reading the input is not measured
+int loadBenchScript(BenchOptions* options, LineVec* lines) {
+    FILE* input;
+    if(options->scriptPath != NULL) {
+        input = fopen(options->scriptPath, "r");
+        if(input == NULL) {
+            fprintf(stderr, "cannot open %s\n", options->scriptPath);
+            return 0;
+        }
+    } else {
+        input = tmpfile();
+        if(input == NULL || !generateBenchScript(&options->script, input)) {
+            fprintf(stderr, "fleet does not fit on the board\n");
+            if(input != NULL) fclose(input);
+            return 0;
+        }
+        fflush(input);
+        rewind(input);
+    }
+
+    LineReader reader;
+    initLineReader(&reader, fileno(input));
+    char* line;
+    while(readLine(&reader, &line) != EOF) {
+        lineVecPushBack(lines, strdup(line));
+    }
+    freeLineReader(&reader);
+    fclose(input);
+    return 1;
+}
+
+uint64_t getBenchNanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+// Commands are told apart by their names, all group lines are one kind
+void getLineKind(const char* line, char* kind) {
+    while(line[0] == ' ') line++;
+    if(line[0] == '[') {
+        strcpy(kind, "[group]");
+        return;
+    }
+
+    int length = 0;
+    while(line[length] != ' ' && line[length] != '\0' && length < BENCH_KIND_NAME_SIZE - 1) {
+        kind[length] = line[length];
+        length++;
+    }
+    kind[length] = '\0';
+}
+
+void recordLatency(StringMap* kinds, const char* kind, uint64_t nanos) {
+    int kindI = stringMapFind(kinds, kind);
+    if(kindI == -1) {
+        LatencyVec* latencies = (LatencyVec*) malloc(sizeof(LatencyVec));
+        initLatencyVec(latencies);
+        kindI = stringMapAdd(kinds, kind, latencies);
+    }
+    latencyVecPushBack((LatencyVec*) kinds->values[kindI], nanos);
+}
+
+/* Runs the script as a new game. Latency of a line covers handling it and flushing its output.
+ * Returns 0 if the game ended before the end of the script. */
+int runBenchScript(LineVec* lines, StringMap* kinds, uint64_t* totalNanos) {
+    Game* game = initGame();
+    size_t copyCapacity = 0;
+    char* lineCopy = NULL;
+    char kind[BENCH_KIND_NAME_SIZE];
+
+    int isFinished = 1;
+    for(int lineI = 0; lineI < lines->length; lineI++) {
+        // Engine may change the line, so every run gets a fresh copy of it
+        size_t lineSize = strlen(lines->ptr[lineI]) + 1;
+        if(lineSize > copyCapacity) {
+            copyCapacity = lineSize;
+            lineCopy = (char*) realloc(lineCopy, copyCapacity);
+        }
+        memcpy(lineCopy, lines->ptr[lineI], lineSize);
+        getLineKind(lineCopy, kind);
+
+        uint64_t start = getBenchNanos();
+        int anyErrors = handleLine(game, lineCopy);
+        flushGameOutput(game);
+        uint64_t elapsed = getBenchNanos() - start;
+
+        *totalNanos += elapsed;
+        recordLatency(kinds, kind, elapsed);
+        if(anyErrors || (hasGameEnded(game) && lineI + 1 < lines->length)) {
+            fprintf(stderr, "game ended at line %d of %d: %s\n", lineI + 1, lines->length, lines->ptr[lineI]);
+            isFinished = 0;
+            break;
+        }
+    }
+
+    free(lineCopy);
+    freeGame(game);
+    return isFinished;
+}
+
+int compareLatencies(const void* first, const void* second) {
+    uint64_t a = *(const uint64_t*) first;
+    uint64_t b = *(const uint64_t*) second;
+    return (a > b) - (a < b);
+}
+
+// Latencies have to be sorted
+uint64_t getPercentile(LatencyVec* latencies, int percent) {
+    return latencies->ptr[(size_t) (latencies->length - 1) * percent / 100];
+}
+
+void printBenchReport(FILE* out, StringMap* kinds, uint64_t totalNanos) {
+    long commandsCount = 0;
+    for(int kindI = 0; kindI < kinds->length; kindI++) {
+        commandsCount += ((LatencyVec*) kinds->values[kindI])->length;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double seconds = (double) totalNanos / 1e9;
+    fprintf(out, "lines          %ld\n", commandsCount);
+    fprintf(out, "time           %.3f s\n", seconds);
+    fprintf(out, "lines/s        %.0f\n", seconds > 0 ? (double) commandsCount / seconds : 0.0);
+    fprintf(out, "peak RSS       %ld KiB\n", usage.ru_maxrss);
+    fprintf(out, "\n%-14s %10s %10s %10s %10s %10s %10s\n", "command", "count", "mean us", "p50 us", "p90 us", "p99 us", "max us");
+
+    for(int kindI = 0; kindI < kinds->length; kindI++) {
+        LatencyVec* latencies = (LatencyVec*) kinds->values[kindI];
+        qsort(latencies->ptr, latencies->length, sizeof(uint64_t), compareLatencies);
+        uint64_t sum = 0;
+        VEC_FOR_EACH(uint64_t, latency, latencies) sum += *latency;
+        fprintf(out, "%-14s %10d %10.2f %10.2f %10.2f %10.2f %10.2f\n", kinds->keys[kindI], latencies->length,
+                (double) sum / latencies->length / 1e3, getPercentile(latencies, 50) / 1e3,
+                getPercentile(latencies, 90) / 1e3, getPercentile(latencies, 99) / 1e3,
+                latencies->ptr[latencies->length - 1] / 1e3);
+    }
+}
@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <string.h>
+#include "benchgen.h"
+#include "prng.h"
+#include "vectors.h"
+
+#define BENCH_PLACEMENT_ATTEMPTS 1000
+#define BENCH_TARGET_ATTEMPTS 16
+#define BENCH_DIRECTIONS_COUNT 4
+
+const int benchShipSizes[BENCH_CLASSES_COUNT] = {5, 4, 3, 2};
+const char* benchClassNames[BENCH_CLASSES_COUNT] = {"CAR", "BAT", "CRU", "DES"};
+// Clockwise, so turning right is the next direction and turning left the previous one
+const char benchDirections[BENCH_DIRECTIONS_COUNT] = {'N', 'E', 'S', 'W'};
+
+typedef struct {
+    int startY;
+    int startX;
+    int endY;
+    int endX;
+} BenchRect;
+
+typedef struct {
+    int playerIndex;
+    int classIndex;
+    int index;
+    int size;
+    int headY;
+    int headX;
+    int direction;
+    int hits; // Bit n is set once part n was hit
+    int movesThisTurn;
+    int shotsThisTurn;
+    int spiesCount;
+} BenchShip;
+
+/* Generator keeps its own model of the game, so every command it writes is accepted by the engine
+ * and the game never ends before the last turn: the last whole part of a fleet is never shot at. */
+typedef struct {
+    const BenchScriptOptions* options;
+    FILE* out;
+    PrngState random;
+    int sizeY;
+    int sizeX;
+    char* reefs;
+    int* cells; // Index of the ship on the field plus 1, 0 for water
+    BenchShip* ships;
+    int shipsCount;
+    int remainingParts[2];
+    int hasShot[2];
+} BenchModel;
+
+int benchRandom(BenchModel* model, int bound) {
+    return (int) (nextPrng(&model->random) % (uint64_t) bound);
+}
+
+// Same as getShipDirMods of the engine, parts of the ship lie at head + n * mod
+void getBenchDirMods(int direction, int* modY, int* modX) {
+    *modY = 0, *modX = 0;
+    switch(benchDirections[direction]) {
+        case 'N':
+            *modY = 1;
+            break;
+        case 'S':
+            *modY = -1;
+            break;
+        case 'E':
+            *modX = -1;
+            break;
+        default:
+            *modX = 1;
+            break;
+    }
+}
+
+// Ship fits if it lies inside the area, not on reefs, and no other ship touches it
+int canPutBenchShip(BenchModel* model, int shipI, int headY, int headX, int direction, BenchRect* area) {
+    BenchShip* ship = &model->ships[shipI];
+    int modY, modX;
+    getBenchDirMods(direction, &modY, &modX);
+    int tailY = headY + (ship->size - 1) * modY;
+    int tailX = headX + (ship->size - 1) * modX;
+    BenchRect rect = {headY < tailY ? headY : tailY, headX < tailX ? headX : tailX,
+                      headY > tailY ? headY : tailY, headX > tailX ? headX : tailX};
+    if(rect.startY < area->startY || rect.startX < area->startX) return 0;
+    if(rect.endY > area->endY || rect.endX > area->endX) return 0;
+
+    for(int nth = 0; nth < ship->size; nth++) {
+        if(model->reefs[(headY + nth * modY) * model->sizeX + headX + nth * modX]) return 0;
+    }
+
+    for(int y = rect.startY - 1; y <= rect.endY + 1; y++) {
+        if(y < 0 || y >= model->sizeY) continue;
+        for(int x = rect.startX - 1; x <= rect.endX + 1; x++) {
+            if(x < 0 || x >= model->sizeX) continue;
+            int cell = model->cells[y * model->sizeX + x];
+            if(cell != 0 && cell != shipI + 1) return 0;
+        }
+    }
+    return 1;
+}
+
+void setBenchShipCells(BenchModel* model, int shipI, int value) {
+    BenchShip* ship = &model->ships[shipI];
+    int modY, modX;
+    getBenchDirMods(ship->direction, &modY, &modX);
+    for(int nth = 0; nth < ship->size; nth++) {
+        model->cells[(ship->headY + nth * modY) * model->sizeX + ship->headX + nth * modX] = value;
+    }
+}
+
+int initBenchModel(BenchModel* model, const BenchScriptOptions* options, FILE* out) {
+    model->options = options;
+    model->out = out;
+    seedPrng(&model->random, options->seed);
+    model->sizeY = options->sizeY;
+    model->sizeX = options->sizeX;
+    size_t fieldsCount = (size_t) options->sizeY * options->sizeX;
+    model->reefs = (char*) calloc(fieldsCount, sizeof(char));
+    model->cells = (int*) calloc(fieldsCount, sizeof(int));
+
+    model->shipsCount = 0;
+    for(int classI = 0; classI < BENCH_CLASSES_COUNT; classI++) {
+        model->shipsCount += 2 * options->fleet[classI];
+    }
+    model->ships = (BenchShip*) calloc(model->shipsCount, sizeof(BenchShip));
+
+    int shipI = 0;
+    for(int playerI = 0; playerI < 2; playerI++) {
+        model->remainingParts[playerI] = 0;
+        model->hasShot[playerI] = 0;
+        for(int classI = 0; classI < BENCH_CLASSES_COUNT; classI++) {
+            for(int i = 0; i < options->fleet[classI]; i++) {
+                BenchShip* ship = &model->ships[shipI++];
+                ship->playerIndex = playerI;
+                ship->classIndex = classI;
+                ship->index = i;
+                ship->size = benchShipSizes[classI];
+                model->remainingParts[playerI] += ship->size;
+            }
+        }
+    }
+    return model->reefs != NULL && model->cells != NULL && (model->ships != NULL || model->shipsCount == 0);
+}
+
+void freeBenchModel(BenchModel* model) {
+    free(model->reefs);
+    free(model->cells);
+    free(model->ships);
+}
+
+void writeBenchState(BenchModel* model) {
+    const BenchScriptOptions* options = model->options;
+    FILE* out = model->out;
+    int halfY = model->sizeY / 2;
+    fprintf(out, "[state]\n");
+    fprintf(out, "BOARD_SIZE %d %d\n", model->sizeY, model->sizeX);
+    fprintf(out, "NEXT_PLAYER A\n");
+    fprintf(out, "INIT_POSITION A 0 0 %d %d\n", halfY - 1, model->sizeX - 1);
+    fprintf(out, "INIT_POSITION B %d 0 %d %d\n", halfY, model->sizeY - 1, model->sizeX - 1);
+    for(int playerI = 0; playerI < 2; playerI++) {
+        fprintf(out, "SET_FLEET %c %d %d %d %d\n", playerI == 0 ? 'A' : 'B',
+                options->fleet[0], options->fleet[1], options->fleet[2], options->fleet[3]);
+    }
+    if(options->extendedShips) fprintf(out, "EXTENDED_SHIPS\n");
+
+    // Engine does not take reefs in the last row
+    for(int y = 0; y < model->sizeY - 1; y++) {
+        for(int x = 0; x < model->sizeX; x++) {
+            if(benchRandom(model, 100) < options->reefsPercent) {
+                model->reefs[y * model->sizeX + x] = 1;
+                fprintf(out, "REEF %d %d\n", y, x);
+            }
+        }
+    }
+    fprintf(out, "[state]\n");
+}
+
+// Returns 0 if some ship did not fit into the starting area of its player
+int writeBenchPlacements(BenchModel* model) {
+    int halfY = model->sizeY / 2;
+    for(int playerI = 0; playerI < 2; playerI++) {
+        char playerX = playerI == 0 ? 'A' : 'B';
+        BenchRect area = {playerI == 0 ? 0 : halfY, 0, playerI == 0 ? halfY - 1 : model->sizeY - 1, model->sizeX - 1};
+        fprintf(model->out, "[player%c]\n", playerX);
+        for(int shipI = 0; shipI < model->shipsCount; shipI++) {
+            BenchShip* ship = &model->ships[shipI];
+            if(ship->playerIndex != playerI) continue;
+
+            int isPlaced = 0;
+            for(int attempt = 0; attempt < BENCH_PLACEMENT_ATTEMPTS && !isPlaced; attempt++) {
+                int headY = area.startY + benchRandom(model, area.endY - area.startY + 1);
+                int headX = benchRandom(model, model->sizeX);
+                int direction = benchRandom(model, BENCH_DIRECTIONS_COUNT);
+                if(!canPutBenchShip(model, shipI, headY, headX, direction, &area)) continue;
+
+                ship->headY = headY, ship->headX = headX, ship->direction = direction;
+                setBenchShipCells(model, shipI, shipI + 1);
+                fprintf(model->out, "PLACE_SHIP %d %d %c %d %s\n", headY, headX, benchDirections[direction],
+                        ship->index, benchClassNames[ship->classIndex]);
+                isPlaced = 1;
+            }
+            if(!isPlaced) return 0;
+        }
+        fprintf(model->out, "[player%c]\n", playerX);
+    }
+    return 1;
+}
+
+// Returns index of a random ship of the player accepted by the filter or -1 if there is none
+int pickBenchShip(BenchModel* model, int playerI, int (*isAccepted)(BenchShip*)) {
+    int start = benchRandom(model, model->shipsCount);
+    for(int offset = 0; offset < model->shipsCount; offset++) {
+        int shipI = (start + offset) % model->shipsCount;
+        BenchShip* ship = &model->ships[shipI];
+        if(ship->playerIndex == playerI && isAccepted(ship)) return shipI;
+    }
+    return -1;
+}
+
+int isBenchPartHit(BenchShip* ship, int nth) {
+    return (ship->hits >> nth) & 1;
+}
+
+int canBenchShipMove(BenchShip* ship) {
+    int maxMoves = ship->classIndex == 0 ? 2 : 3;
+    return !isBenchPartHit(ship, ship->size - 1) && ship->movesThisTurn < maxMoves;
+}
+
+int canBenchShipShoot(BenchShip* ship) {
+    return !isBenchPartHit(ship, 1) && ship->shotsThisTurn < ship->size;
+}
+
+int canBenchShipSpy(BenchShip* ship) {
+    return ship->classIndex == 0 && !isBenchPartHit(ship, 1) && ship->spiesCount < MAX_SPY_PLANES;
+}
+
+// Plane sent by a ship of extended ships takes one of its shots
+int canBenchShipSpyExtended(BenchShip* ship) {
+    return canBenchShipSpy(ship) && ship->shotsThisTurn < ship->size;
+}
+
+// Moves are computed like in moveShip of the engine, the first of them in random order which fits is made
+void writeBenchMove(BenchModel* model, int playerI) {
+    int shipI = pickBenchShip(model, playerI, canBenchShipMove);
+    if(shipI == -1) return;
+    BenchShip* ship = &model->ships[shipI];
+    BenchRect board = {0, 0, model->sizeY - 1, model->sizeX - 1};
+
+    const char moves[3] = {'F', 'L', 'R'};
+    int firstMove = benchRandom(model, 3);
+    for(int moveI = 0; moveI < 3; moveI++) {
+        char move = moves[(firstMove + moveI) % 3];
+        int modY, modX;
+        getBenchDirMods(ship->direction, &modY, &modX);
+        int headY = ship->headY - modY;
+        int headX = ship->headX - modX;
+        int direction = ship->direction;
+        if(move == 'L') {
+            headX -= (ship->size - 1) * modY;
+            headY += (ship->size - 1) * modX;
+            direction = (direction + BENCH_DIRECTIONS_COUNT - 1) % BENCH_DIRECTIONS_COUNT;
+        } else if(move == 'R') {
+            headX += (ship->size - 1) * modY;
+            headY += (ship->size - 1) * modX;
+            direction = (direction + 1) % BENCH_DIRECTIONS_COUNT;
+        }
+        if(!canPutBenchShip(model, shipI, headY, headX, direction, &board)) continue;
+
+        setBenchShipCells(model, shipI, 0);
+        ship->headY = headY, ship->headX = headX, ship->direction = direction;
+        setBenchShipCells(model, shipI, shipI + 1);
+        ship->movesThisTurn++;
+        fprintf(model->out, "MOVE %d %s %c\n", ship->index, benchClassNames[ship->classIndex], move);
+        return;
+    }
+}
+
+// Field may be shot at unless it holds the last whole part of a fleet
+int isBenchShotAllowed(BenchModel* model, int y, int x) {
+    int cell = model->cells[y * model->sizeX + x];
+    if(cell == 0) return 1;
+    BenchShip* ship = &model->ships[cell - 1];
+    int nth = abs(y - ship->headY) + abs(x - ship->headX);
+    return isBenchPartHit(ship, nth) || model->remainingParts[ship->playerIndex] > 1;
+}
+
+void applyBenchShot(BenchModel* model, int y, int x) {
+    int cell = model->cells[y * model->sizeX + x];
+    if(cell == 0) return;
+    BenchShip* ship = &model->ships[cell - 1];
+    int nth = abs(y - ship->headY) + abs(x - ship->headX);
+    if(isBenchPartHit(ship, nth)) return;
+    ship->hits |= 1 << nth;
+    model->remainingParts[ship->playerIndex]--;
+}
+
+// Returns 0 if no allowed field was drawn, shooter limits the fields to the range of its cannon
+int drawBenchTarget(BenchModel* model, BenchShip* shooter, int* targetY, int* targetX) {
+    for(int attempt = 0; attempt < BENCH_TARGET_ATTEMPTS; attempt++) {
+        int y = benchRandom(model, model->sizeY);
+        int x = benchRandom(model, model->sizeX);
+        if(shooter != NULL && shooter->classIndex != 0) {
+            int modY, modX;
+            getBenchDirMods(shooter->direction, &modY, &modX);
+            int cannonY = shooter->headY + modY;
+            int cannonX = shooter->headX + modX;
+            y = cannonY - shooter->size + benchRandom(model, 2 * shooter->size + 1);
+            x = cannonX - shooter->size + benchRandom(model, 2 * shooter->size + 1);
+            if(y < 0 || y >= model->sizeY || x < 0 || x >= model->sizeX) continue;
+            int distanceSquared = (y - cannonY) * (y - cannonY) + (x - cannonX) * (x - cannonX);
+            if(distanceSquared > shooter->size * shooter->size) continue;
+        }
+        if(!isBenchShotAllowed(model, y, x)) continue;
+
+        *targetY = y, *targetX = x;
+        return 1;
+    }
+    return 0;
+}
+
+// In the basic mode a player shoots once and not again until the other player has shot
+void writeBenchShot(BenchModel* model, int playerI) {
+    int y, x;
+    if(!model->options->extendedShips) {
+        if(model->hasShot[playerI] || !drawBenchTarget(model, NULL, &y, &x)) return;
+        model->hasShot[playerI] = 1;
+        model->hasShot[!playerI] = 0;
+        fprintf(model->out, "SHOOT %d %d\n", y, x);
+        applyBenchShot(model, y, x);
+        return;
+    }
+
+    int shipI = pickBenchShip(model, playerI, canBenchShipShoot);
+    if(shipI == -1) return;
+    BenchShip* shooter = &model->ships[shipI];
+    if(!drawBenchTarget(model, shooter, &y, &x)) return;
+    shooter->shotsThisTurn++;
+    fprintf(model->out, "SHOOT %d %s %d %d\n", shooter->index, benchClassNames[shooter->classIndex], y, x);
+    applyBenchShot(model, y, x);
+}
+
+void writeBenchSpy(BenchModel* model, int playerI) {
+    int shipI = pickBenchShip(model, playerI,
+                              model->options->extendedShips ? canBenchShipSpyExtended : canBenchShipSpy);
+    if(shipI == -1) return;
+    BenchShip* carrier = &model->ships[shipI];
+    carrier->spiesCount++;
+    carrier->shotsThisTurn++;
+    fprintf(model->out, "SPY %d %d %d\n", carrier->index, benchRandom(model, model->sizeY), benchRandom(model, model->sizeX));
+}
+
+void writeBenchTurn(BenchModel* model, int playerI) {
+    const BenchScriptOptions* options = model->options;
+    char playerX = playerI == 0 ? 'A' : 'B';
+    fprintf(model->out, "[player%c]\n", playerX);
+    for(int moveI = 0; moveI < options->movesPerTurn; moveI++) writeBenchMove(model, playerI);
+    for(int spyI = 0; spyI < options->spiesPerTurn; spyI++) writeBenchSpy(model, playerI);
+    for(int shotI = 0; shotI < options->shotsPerTurn; shotI++) writeBenchShot(model, playerI);
+    for(int printI = 0; printI < options->printsPerTurn; printI++) fprintf(model->out, "PRINT 0\n");
+    fprintf(model->out, "[player%c]\n", playerX);
+
+    for(int shipI = 0; shipI < model->shipsCount; shipI++) {
+        BenchShip* ship = &model->ships[shipI];
+        if(ship->playerIndex != playerI) continue;
+        ship->movesThisTurn = 0;
+        ship->shotsThisTurn = 0;
+    }
+}
+
+void initBenchScriptOptions(BenchScriptOptions* options) {
+    options->seed = 1;
+    options->sizeY = 21;
+    options->sizeX = 10;
+    const int defaultFleet[BENCH_CLASSES_COUNT] = {1, 2, 3, 4};
+    memcpy(options->fleet, defaultFleet, sizeof(defaultFleet));
+    options->reefsPercent = 2;
+    options->turnsCount = 1000;
+    options->movesPerTurn = 2;
+    options->shotsPerTurn = 1;
+    options->spiesPerTurn = 0;
+    options->printsPerTurn = 1;
+    options->extendedShips = 0;
+}
+
+/* Writes a whole game: the state, placements of both fleets and then turns of players A and B
+ * in turn. The same options give the same script. Returns 0 if a fleet did not fit on the board. */
+int generateBenchScript(const BenchScriptOptions* options, FILE* out) {
+    BenchModel model;
+    if(!initBenchModel(&model, options, out)) {
+        freeBenchModel(&model);
+        return 0;
+    }
+
+    writeBenchState(&model);
+    int isPlaced = writeBenchPlacements(&model);
+    for(int turnI = 0; isPlaced && turnI < options->turnsCount; turnI++) {
+        writeBenchTurn(&model, turnI % 2);
+    }
+
+    freeBenchModel(&model);
+    return isPlaced;
+}
@@ -0,0 +1,28 @@
+#ifndef CBATTLESHIPS_BENCHGEN_H
+#define CBATTLESHIPS_BENCHGEN_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define BENCH_CLASSES_COUNT 4
+
+/* Shape of a generated game. Fleet counts are per player (carriers first), reefs are given in
+ * percent of fields and limits of a turn say how many commands of the kind a player issues at most. */
+typedef struct {
+    uint64_t seed;
+    int sizeY;
+    int sizeX;
+    int fleet[BENCH_CLASSES_COUNT];
+    int reefsPercent;
+    int turnsCount;
+    int movesPerTurn;
+    int shotsPerTurn;
+    int spiesPerTurn;
+    int printsPerTurn;
+    int extendedShips;
+} BenchScriptOptions;
+
+void initBenchScriptOptions(BenchScriptOptions* options);
+int generateBenchScript(const BenchScriptOptions* options, FILE* out);
+
+#endif //CBATTLESHIPS_BENCHGEN_H
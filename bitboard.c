@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bitboard.h"
+
+void initBitboard(Bitboard* board) {
+    board->words = NULL;
+    board->sizeY = 0;
+    board->sizeX = 0;
+    board->stride = 0;
+    board->isSparse = 0;
+    initTileMap(&board->tiles, TILE_SIDE * sizeof(uint64_t), 0);
+}
+
+size_t getBitboardWordsCount(int sizeY, int sizeX) {
+    if(sizeY <= 0 || sizeX <= 0) return 0;
+    return (size_t) sizeY * ((sizeX + BITBOARD_WORD_BITS - 1) / BITBOARD_WORD_BITS);
+}
+
+// Board uses words given by the caller (getBitboardWordsCount of them), which stay owned by the caller
+void attachBitboard(Bitboard* board, uint64_t* words, int sizeY, int sizeX) {
+    if(sizeY <= 0 || sizeX <= 0) {
+        sizeY = 0;
+        sizeX = 0;
+    }
+    board->sizeY = sizeY;
+    board->sizeX = sizeX;
+    board->stride = (sizeX + BITBOARD_WORD_BITS - 1) / BITBOARD_WORD_BITS;
+    board->words = words;
+    board->isSparse = 0;
+}
+
+// Content is not preserved, board is empty after resizing
+void resizeBitboard(Bitboard* board, int sizeY, int sizeX) {
+    free(board->words);
+    uint64_t* words = (uint64_t*) calloc(getBitboardWordsCount(sizeY, sizeX), sizeof(uint64_t));
+    attachBitboard(board, words, sizeY, sizeX);
+}
+
+// Board holding no words, tiles are allocated on demand and owned by the board
+void initSparseBitboard(Bitboard* board, int sizeY, int sizeX) {
+    initBitboard(board);
+    attachBitboard(board, NULL, sizeY, sizeX);
+    board->isSparse = 1;
+}
+
+void copySparseBitboard(Bitboard* dest, Bitboard* source) {
+    *dest = *source;
+    copyTileMap(&dest->tiles, &source->tiles);
+}
+
+void clearBitboard(Bitboard* board) {
+    if(board->isSparse) {
+        clearTileMap(&board->tiles);
+        return;
+    }
+    memset(board->words, 0, (size_t) board->sizeY * board->stride * sizeof(uint64_t));
+}
+
+void freeBitboard(Bitboard* board) {
+    if(board->isSparse) {
+        clearTileMap(&board->tiles);
+    } else {
+        free(board->words);
+    }
+    initBitboard(board);
+}
+
+// Only for dense boards
+uint64_t* getBitboardRow(Bitboard* board, int y) {
+    return board->words + (size_t) y * board->stride;
+}
+
+uint64_t getBitboardWord(Bitboard* board, int y, int word) {
+    if(!board->isSparse) return getBitboardRow(board, y)[word];
+
+    uint64_t* tile = (uint64_t*) findTile(&board->tiles, y / TILE_SIDE, word);
+    return tile == NULL ? 0 : tile[y % TILE_SIDE];
+}
+
+// Word which may be written to, on sparse boards its tile is allocated when missing
+uint64_t* getBitboardWordToUpdate(Bitboard* board, int y, int word) {
+    if(!board->isSparse) return getBitboardRow(board, y) + word;
+
+    uint64_t* tile = (uint64_t*) getOrAddTile(&board->tiles, y / TILE_SIDE, word);
+    return tile + y % TILE_SIDE;
+}
+
+// Mask of bits of the word which lie between fromX and toX (inclusive)
+uint64_t getBitboardRangeMask(int word, int fromX, int toX) {
+    uint64_t mask = ~(uint64_t) 0;
+    if(word == fromX / BITBOARD_WORD_BITS) mask &= ~(uint64_t) 0 << (fromX % BITBOARD_WORD_BITS);
+    if(word == toX / BITBOARD_WORD_BITS) mask &= ~(uint64_t) 0 >> (BITBOARD_WORD_BITS - 1 - toX % BITBOARD_WORD_BITS);
+    return mask;
+}
+
+void setBitboardBit(Bitboard* board, int y, int x) {
+    *getBitboardWordToUpdate(board, y, x / BITBOARD_WORD_BITS) |= (uint64_t) 1 << (x % BITBOARD_WORD_BITS);
+}
+
+// Clearing never allocates, a missing tile has no bits to clear
+void clearBitboardBit(Bitboard* board, int y, int x) {
+    int word = x / BITBOARD_WORD_BITS;
+    if(board->isSparse && findTile(&board->tiles, y / TILE_SIDE, word) == NULL) return;
+    *getBitboardWordToUpdate(board, y, word) &= ~((uint64_t) 1 << (x % BITBOARD_WORD_BITS));
+}
+
+int testBitboardBit(Bitboard* board, int y, int x) {
+    return (getBitboardWord(board, y, x / BITBOARD_WORD_BITS) >> (x % BITBOARD_WORD_BITS)) & 1;
+}
+
+// Rectangle is clipped to the board, so parts of it lying outside are treated as empty
+int isAnyBitInRect(Bitboard* board, int startY, int startX, int endY, int endX) {
+    if(startY < 0) startY = 0;
+    if(startX < 0) startX = 0;
+    if(endY > board->sizeY - 1) endY = board->sizeY - 1;
+    if(endX > board->sizeX - 1) endX = board->sizeX - 1;
+    if(startX > endX) return 0;
+
+    int fromWord = startX / BITBOARD_WORD_BITS;
+    int toWord = endX / BITBOARD_WORD_BITS;
+    for(int y = startY; y <= endY; y++) {
+        for(int word = fromWord; word <= toWord; word++) {
+            if(getBitboardWord(board, y, word) & getBitboardRangeMask(word, startX, endX)) return 1;
+        }
+    }
+    return 0;
+}
+
+int countBitboardBits(Bitboard* board) {
+    int count = 0;
+    BitboardCursor cursor;
+    int y, x;
+    if(board->isSparse) {
+        initBitboardCursor(&cursor);
+        while(nextBitboardBit(board, &cursor, &y, &x)) count++;
+        return count;
+    }
+
+    size_t wordsCount = (size_t) board->sizeY * board->stride;
+    for(size_t wordI = 0; wordI < wordsCount; wordI++) {
+        count += __builtin_popcountll(board->words[wordI]);
+    }
+    return count;
+}
+
+// Clears the lowest set bit of a non-zero word and returns its index
+int popBitboardLowestBit(uint64_t* word) {
+    int index = __builtin_ctzll(*word);
+    *word &= *word - 1;
+    return index;
+}
+
+void initBitboardCursor(BitboardCursor* cursor) {
+    cursor->slot = -1;
+    cursor->row = -1;
+    cursor->word = 0;
+    cursor->bits = 0;
+}
+
+// Moves the cursor to the next word, on sparse boards going tile after tile in no particular order
+int advanceBitboardCursor(Bitboard* board, BitboardCursor* cursor) {
+    if(!board->isSparse) {
+        if(cursor->row < 0 || ++cursor->word >= board->stride) {
+            cursor->word = 0;
+            if(++cursor->row >= board->sizeY) return 0;
+        }
+        cursor->bits = getBitboardRow(board, cursor->row)[cursor->word];
+        return 1;
+    }
+
+    TileMap* tiles = &board->tiles;
+    if(cursor->slot >= 0 && ++cursor->row < TILE_SIDE) {
+        cursor->bits = ((uint64_t*) tiles->tiles[cursor->slot])[cursor->row];
+        return 1;
+    }
+    do {
+        if(++cursor->slot >= tiles->capacity) return 0;
+    } while(tiles->tiles[cursor->slot] == NULL);
+    cursor->row = 0;
+    cursor->bits = ((uint64_t*) tiles->tiles[cursor->slot])[0];
+    return 1;
+}
+
+/* Gives coordinates of the next set bit, dense boards are walked row by row. The board may not be
+ * changed in between, except for clearing bits which were already given. */
+int nextBitboardBit(Bitboard* board, BitboardCursor* cursor, int* y, int* x) {
+    while(cursor->bits == 0) {
+        if(!advanceBitboardCursor(board, cursor)) return 0;
+    }
+    int bit = popBitboardLowestBit(&cursor->bits);
+    if(!board->isSparse) {
+        *y = cursor->row;
+        *x = cursor->word * BITBOARD_WORD_BITS + bit;
+        return 1;
+    }
+
+    int tileY, word;
+    getTileCoords(board->tiles.keys[cursor->slot], &tileY, &word);
+    *y = tileY * TILE_SIDE + cursor->row;
+    *x = word * BITBOARD_WORD_BITS + bit;
+    return 1;
+}
@@ -0,0 +1,52 @@
+#ifndef CBATTLESHIPS_BITBOARD_H
+#define CBATTLESHIPS_BITBOARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tilemap.h"
+
+#define BITBOARD_WORD_BITS 64
+
+/* One bit per field, every row is made of stride 64-bit words (bit i of word w is field w*64+i).
+ * Sparse boards keep no words, rows are cut into tiles of TILE_SIDE rows by one word which are
+ * allocated on the first set bit, so only the whole-board helpers below may be used on them. */
+typedef struct {
+    uint64_t* words;
+    int sizeY;
+    int sizeX;
+    int stride;
+    int isSparse;
+    TileMap tiles;
+} Bitboard;
+
+// Position of the walk over set bits, see nextBitboardBit
+typedef struct {
+    int slot;
+    int row;
+    int word;
+    uint64_t bits;
+} BitboardCursor;
+
+void initBitboard(Bitboard* board);
+size_t getBitboardWordsCount(int sizeY, int sizeX);
+void attachBitboard(Bitboard* board, uint64_t* words, int sizeY, int sizeX);
+void resizeBitboard(Bitboard* board, int sizeY, int sizeX);
+void initSparseBitboard(Bitboard* board, int sizeY, int sizeX);
+void copySparseBitboard(Bitboard* dest, Bitboard* source);
+void clearBitboard(Bitboard* board);
+void freeBitboard(Bitboard* board);
+
+uint64_t* getBitboardRow(Bitboard* board, int y);
+uint64_t getBitboardWord(Bitboard* board, int y, int word);
+uint64_t* getBitboardWordToUpdate(Bitboard* board, int y, int word);
+uint64_t getBitboardRangeMask(int word, int fromX, int toX);
+void setBitboardBit(Bitboard* board, int y, int x);
+void clearBitboardBit(Bitboard* board, int y, int x);
+int testBitboardBit(Bitboard* board, int y, int x);
+int isAnyBitInRect(Bitboard* board, int startY, int startX, int endY, int endX);
+int countBitboardBits(Bitboard* board);
+int popBitboardLowestBit(uint64_t* word);
+void initBitboardCursor(BitboardCursor* cursor);
+int nextBitboardBit(Bitboard* board, BitboardCursor* cursor, int* y, int* x);
+
+#endif //CBATTLESHIPS_BITBOARD_H
@@ -0,0 +1,13 @@
+#ifndef CBATTLESHIPS_ENGINE_H
+#define CBATTLESHIPS_ENGINE_H
+
+// Game engine as seen by programs linking main.c without its main, like the benchmark
+typedef struct Game Game;
+
+Game* initGame();
+int handleLine(Game* game, char* line);
+int hasGameEnded(Game* game);
+void flushGameOutput(Game* game);
+void freeGame(Game* game);
+
+#endif //CBATTLESHIPS_ENGINE_H
@@ -1,20 +1,61 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include "vectors.h"
-
-#define LINE_MAX_SIZE 100
+#include "reader.h"
+#include "bitboard.h"
+#include "strmap.h"
+#include "batchqueue.h"
+#include "snapshot.h"
+#include "arena.h"
+#include "prng.h"
+#include "engine.h"
+#include "stats.h"
+#include "tilemap.h"
+
+#define GROUP_NAME_MAX_SIZE 98
 #define MAX_CMD_ELEMENTS 10
-#define MAX_SHIPS 10
+#define MAX_CMD_ARGS (MAX_CMD_ELEMENTS - 1)
 #define true 1
 #define false 0
 
+#define INITIAL_REEFS_CAPACITY 16
+#define SCRATCH_ARENA_BLOCK_SIZE (1 << 14)
+#define BOARD_BITBOARDS_COUNT (1 + 4 * PLAYERS_COUNT)
+#define TARGET_KNOWN_PART_BOOST 16
+#define FLEET_PACKER_TIME_BUDGET_MS 200
+#define FLEET_PACKER_CLOCK_INTERVAL 1024
+#define AI_RANDOM_LAYOUT_ATTEMPTS 8
+#define SERVER_BATCH_SIZE (1 << 16)
+#define SERVER_QUEUE_CAPACITY 8
+#define PRINT_FLUSH_THRESHOLD (1 << 20)
+#define AI_TABLE_MAX_FIELDS (1 << 22)
+#define AI_PLACEMENT_MAX_FIELDS (1 << 14)
+#define AI_SPARSE_ATTEMPTS 4096
+#define OFF_BOARD_GRID_SIDE 8
+
+// Boards with at least this many fields keep their indexes in tiles allocated on demand
+#ifndef SPARSE_BOARD_MIN_FIELDS
+#define SPARSE_BOARD_MIN_FIELDS (1 << 22)
+#endif
+
 #define PLAYERS_COUNT 2
 #define TYPES_COUNT 4
 #define CARRIERS 0
 #define BATTLESHIPS 1
 #define CRUISERS 2
 #define DESTROYERS 3
+#define DIRECTIONS_COUNT 4
+
+// Flags of a ship in the fleet of its player
+#define SHIP_PLACED 1
+#define SHIP_SUNK 2
 
 /* ===========================
  * Program CBattleShips
@@ -25,6 +66,22 @@
 /* ============
  * Enumerations
  * ============*/
+enum GroupKind {
+    GROUP_STATE, GROUP_PLAYER, GROUP_UNKNOWN, GROUP_KINDS_COUNT
+};
+
+enum CommandKind {
+    CMD_PRINT, CMD_SET_FLEET, CMD_NEXT_PLAYER, CMD_BOARD_SIZE, CMD_INIT_POSITION, CMD_REEF, CMD_SHIP,
+    CMD_EXTENDED_SHIPS, CMD_SAVE, CMD_SET_AI_PLAYER, CMD_PLACE_SHIP, CMD_SHOOT, CMD_MOVE, CMD_SPY, CMD_SRAND,
+    CMD_RANDOM_STATE, CMD_STATS,
+    CMD_SAVE_BINARY, CMD_LOAD_BINARY,
+    CMD_UNKNOWN, COMMAND_KINDS_COUNT
+};
+
+// What a player knows about a field of the board when it aims at the enemy
+enum TargetKnowledge {
+    TARGET_UNKNOWN, TARGET_MISS, TARGET_HIT, TARGET_SHIP, TARGET_BLOCKED
+};
 
 /* =================
  * Types definitions
@@ -36,74 +93,292 @@ typedef struct {
 } Rectangle;
 
 typedef struct {
-    char* commandGroup;
+    enum GroupKind groupKind;
+    enum CommandKind kind;
+    int playerIndex;
+    char* line;
     char* commandName;
-    char** commandArgs;
+    char* commandArgs[MAX_CMD_ARGS];
+    int intArgs[MAX_CMD_ARGS];
     int argsCount;
 } Command;
 
+// Entry of the board cell index, all indexes are -1 if the cell is free
+typedef struct {
+    int32_t shipId;
+    int8_t playerIndex;
+    int8_t nth;
+} ShipCell;
+
+// Output of a game is composed here and written at once after every handled line
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} FrameBuffer;
+
+/* Ships of a player kept in columns indexed by a dense ship id, so loops over the fleet touch only
+ * the columns they read. Ships of a class have consecutive ids from the start of the class, carriers
+ * go first and only they own spy plane slots. Columns share one block, which is copied as a whole
+ * when the game is cloned. */
+typedef struct {
+    int classStarts[TYPES_COUNT + 1];
+    char* block;
+    size_t blockSize;
+    Point* heads;
+    int* timesMoved;
+    int* shotsThisTurn;
+    int* spyPlanesCounts;
+    Point* spyPlanes;
+    unsigned char* directions;
+    unsigned char* sizes;
+    unsigned char* shots;
+    unsigned char* flags;
+} Fleet;
+
 typedef struct {
     int typesCounts[TYPES_COUNT];
-    Ship ships[TYPES_COUNT][MAX_SHIPS];
+    Fleet fleet;
     int hasShoot;
     Rectangle initArea;
     int isAI;
+    int remainingParts;
 } Player;
 
+// Command and output buffers of a game, which are not a part of its state, so clones share them
 typedef struct {
-    Player** players;
+    Command command;
+    Arena scratch;
+    FrameBuffer output;
+    FrameBuffer prefixedOutput;
+    char* outputPrefix;
+} GameSession;
+
+/* Game is plain data except for fleets and the board arena, one block holding bitboard words, the
+ * cell index, reveal counters and reefs. Pointers into the arena are derived from the board size and
+ * reefs capacity, so a game is cloned by copying the struct, the arena and fleet blocks. Sparse boards keep only
+ * reefs in the arena, bitboards, the cell index and reveal counters live in tile maps which
+ * are copied one by one, so memory follows the occupied area instead of the board size. Parts of
+ * ships sticking out of the board are counted per field in a grid of OFF_BOARD_GRID_SIDE cells
+ * hashed by their coordinates, so adjacency checks only look at fields around the ship. */
+typedef struct Game {
+    Player players[PLAYERS_COUNT];
     int nextPlayerIndex;
-    char groupName[LINE_MAX_SIZE - 2];
+    char groupName[GROUP_NAME_MAX_SIZE];
+    enum GroupKind groupKind;
+    int groupPlayerIndex;
     int isInsideGroup;
     int shouldEnd;
     int planeSizeX;
     int planeSizeY;
-    PointVec* reefs;
+    Point* reefs;
+    int reefsCount;
+    int reefsCapacity;
+    Bitboard reefsMap;
+    ShipCell* shipCells;
+    int* revealCounts[PLAYERS_COUNT];
+    int isSparseBoard;
+    TileMap shipCellTiles;
+    TileMap revealCountTiles[PLAYERS_COUNT];
+    Bitboard shipsMaps[PLAYERS_COUNT];
+    Bitboard hitsMaps[PLAYERS_COUNT];
+    Bitboard visibilityMaps[PLAYERS_COUNT];
+    Bitboard shotsMaps[PLAYERS_COUNT];
+    int offBoardParts;
+    TileMap offBoardPartTiles;
+    char* boardArena;
+    size_t boardArenaSize;
+    size_t boardArenaCapacity;
+    GameSession* session;
     int extendedShips;
     unsigned int randomSeed;
     int wasSeedGiven;
+    int wasStateGiven;
+    PrngState randomState;
 } Game;
 
+/* Probability density of enemy ship parts over the fields, as seen by one player. Density of a field
+ * is the summed weight of all placements of remaining enemy ships which lie in the fleet area and
+ * do not cross a field known to be free. Grids live in the scratch arena for the time of one AI move. */
+typedef struct {
+    Game* game;
+    int playerIndex;
+    int enemyIndex;
+    int remainingCounts[TYPES_COUNT];
+    Rectangle fleetArea;
+    unsigned char* knowledge;
+    int64_t* density;
+} TargetingEngine;
+
+typedef struct {
+    Point head;
+    enum Direction direction;
+} PlacementCandidate;
+
+/* Right placements of ships of one class, kept dense for uniform sampling. Slot numbers every head
+ * in the initial position area together with a direction, slots holds index of the candidate of
+ * the slot (or -1), so a candidate is removed in O(1). */
+typedef struct {
+    PlacementCandidate* candidates;
+    int count;
+    int* slots;
+} PlacementSet;
+
+typedef struct {
+    int classIndex;
+    int slot;
+    int index;
+} RemovedPlacement;
+
+/* Removed candidates are logged, so sets are brought back to an earlier state without building
+ * them again. */
+typedef struct {
+    Game* game;
+    Rectangle area;
+    int areaSizeY;
+    int areaSizeX;
+    PlacementSet sets[TYPES_COUNT];
+    RemovedPlacement* removed;
+    int removedCount;
+} PlacementGenerator;
+
+enum PackResult {
+    PACK_FOUND, PACK_INFEASIBLE, PACK_TIMEOUT
+};
+
+typedef struct {
+    int classIndex;
+    int isVertical;
+    Point start;
+} PackedShip;
+
+/* Backtracking search for a layout of all unplaced ships in the area grown by one field. Starts
+ * mark where grown right placements of every class and orientation begin, decided marks fields
+ * covered by packed ships or left empty, of which there can be at most slack. */
+typedef struct {
+    PlacementGenerator* generator;
+    int shipsLeft[TYPES_COUNT];
+    int shipsCount;
+    Bitboard starts[TYPES_COUNT][2];
+    Bitboard decided;
+    int slack;
+    int* wastedFields;
+    int wastedCount;
+    PackedShip* packed;
+    long nodesCount;
+    int64_t deadline;
+} FleetPacker;
+
+typedef struct {
+    int shipId;
+    PlacementCandidate candidate;
+} AIPlacement;
+
+// Games of a shard are handled only by its thread
+typedef struct {
+    BatchQueue queue;
+    StringMap games;
+    pthread_t thread;
+} Shard;
+
 /* ================
  * Global constants
  * ===============*/
 const int shipsSizes[4] = {5, 4, 3, 2};
-const enum Direction directions[4] = {N, W, S, E};
+const enum Direction directions[DIRECTIONS_COUNT] = {N, W, S, E};
+const ShipCell emptyShipCell = {-1, -1, -1};
 
 /* ==================================
  * Command handling related functions
  * ==================================*/
-int readLine(char* line);
-int splitStringIntoWords(char* strToSplit, char* wordsOut[]);
+int splitStringIntoWords(char* strToSplit, char* wordsOut[], int maxWords);
 int isLineGroup(const char*);
 int handleGroup(char*, Game*);
 int updateNextPlayer(char*, const char*, Game*);
-void formCommand(Command*, char*, char*);
+void formCommand(Command*, Game*, char*);
+enum CommandKind getCommandKind(const char*);
 int handleCommand(Command*, Game*);
-void printErrorFromLine(char*, char*);
-void printError(Command*, char*);
-void getLineFromCmd(Command* cmd, char* line);
+void printErrorFromLine(char*, Game*, char*);
+void printError(Command*, Game*, char*);
+void gamePrintf(Game*, const char*, ...);
+void flushGameOutput(Game*);
+void seedGameRandom(Game*, unsigned int);
+int gameRandom(Game*);
+int parseIntArg(const char*);
+
+/* ==========================
+ * Frame buffer functions
+ * ==========================*/
+void initFrameBuffer(FrameBuffer*);
+void reserveFrameBuffer(FrameBuffer*, size_t);
+void freeFrameBuffer(FrameBuffer*);
+
+/* ===============
+ * Fleet functions
+ * ===============*/
+void initFleet(Fleet*, const int[TYPES_COUNT]);
+size_t getFleetBlockSize(Fleet*);
+void assignFleetColumns(Fleet*);
+void copyFleet(Fleet*, Fleet*);
+void freeFleet(Fleet*);
+int getFleetShipsCount(Fleet*);
+int getFleetShipId(Fleet*, int, int);
+int getFleetShipClass(Fleet*, int);
+Ship getFleetShip(Fleet*, int);
 
 /* ============
  * Constructors
  *= ===========*/
 Ship createNewShip(int, int);
-Player* createNewPlayer();
+Player createNewPlayer();
 Game* initGame();
+GameSession* createGameSession();
+void freeGameSession(GameSession*);
+void cloneGame(Game*, Game*);
+void freeGameClone(Game*);
 
 /* =================
  * Utility functions
  * =================*/
-int areAllShipsPlaced(Player**);
+int areAllShipsPlaced(Player*);
 int getCurrentPlayer(Command*);
 int getClassIndex(char*);
-void getShipElementsOfPlayer(Player*, ShipElementVec*);
-void getAllShipElements(ShipElementVec*, Player**);
 int getPlayerRemainingCount(Player*);
+int isShotAt(Ship*, int);
+int isInsideBoard(Game*, int, int);
+void addPlacedShipParts(Player*, int);
+void recountRemainingParts(Player*);
 Rectangle getRectOccupiedBy(Ship);
+Point pointOf(int, int);
 int isShipOnReef(Ship ship, Game* game);
 int isTooCloseToOtherShip(Ship*, Game*);
-void freeAllSpyPlanes(Game* game);
+void getShipDirMods(Ship*, int*, int*);
+int isInCannonRange(Ship*, int, int);
+int getTileFieldIndex(int, int);
+const ShipCell* getShipCellAt(Game*, int, int);
+ShipCell* getShipCellToUpdate(Game*, int, int);
+int* getRevealCountToUpdate(Game*, int, int, int);
+int getOffBoardGridCell(int);
+int* getOffBoardPartCount(Game*, int, int, int);
+int getOffBoardPartsAt(Game*, int, int);
+void addOffBoardPart(Game*, int, int, int);
+void markShipCells(Game*, Ship*, int, int);
+void revealShipSight(Game*, int, Ship*, int);
+void revealRect(Game*, int, Rectangle, int);
+void addRevealAt(Game*, int, int, int, int);
+void addShipToBoard(Game*, int, Ship*);
+void removeShipFromBoard(Game*, int, Ship*);
+size_t getBoardArenaSize(Game*);
+void assignBoardArena(Game*);
+void layoutBoardArena(Game*, int);
+int isSparseBoardSize(int, int);
+void listBoardBitboards(Game*, Bitboard**);
+void freeSparseBoard(Game*, int);
+void rebuildBoardIndexes(Game*);
+Fleet* getCellFleet(Game*, const ShipCell*);
+int getClassIndexBySize(int);
+void rebuildReefMap(Game*);
+void markReef(Game*, Point);
 char getCharOfPlayerIndex(int index);
 int getIndexOfPlayerChar(char playerChar);
 void freeGame(Game*);
@@ -113,12 +388,12 @@ void freeGame(Game*);
  * ================*/
 int placeShip(Command*, Game*);
 int shoot(Command*, Game*);
-int setFleet(Command* cmd, Player**);
+int setFleet(Command* cmd, Game*);
 void updateTypesCounts(Player*, const int[]);
 int setNextPlayer(Command*, Game*);
 int statePrint(Command *cmd, Game *game);
 int setBoardSize(Command*, Game*);
-int setInitPos(Command*, Player**);
+int setInitPos(Command*, Game*);
 int addReef(Command*, Game*);
 int shipCommand(Command*, Game*);
 int moveShip(Command*, Game*);
@@ -126,176 +401,649 @@ int shootExtended(Command*, Game*);
 int playerPrint(Command*, Game*);
 int placeSpy(Command*, Game*);
 int saveGame(Game*);
+int saveCommand(Command*, Game*);
+int setExtendedShips(Command*, Game*);
+int shootCommand(Command*, Game*);
 int setAIPlayer(Command*, Game*);
 int setSrand(Command*, Game*);
+int setRandomState(Command*, Game*);
+int saveBinaryCommand(Command*, Game*);
+int loadBinaryCommand(Command*, Game*);
+int statsCommand(Command*, Game*);
+
+typedef int (*CommandHandler)(Command*, Game*);
+int callCountedHandler(enum StatsKind, CommandHandler, Command*, Game*);
 
 void handleAI(Game*);
 
+/* ============
+ * AI placement
+ * ============*/
+void initPlacementGenerator(PlacementGenerator*, Game*, Player*);
+int getPlacementSlot(PlacementGenerator*, Point, int);
+PlacementCandidate getPlacementOfSlot(PlacementGenerator*, int);
+void removePlacementCandidate(PlacementGenerator*, PlacementSet*, int);
+void restorePlacementCandidates(PlacementGenerator*, int);
+void excludePlacementsAround(PlacementGenerator*, Ship*);
+int getDirectionIndex(enum Direction);
+void initFleetPacker(FleetPacker*, PlacementGenerator*, Player*);
+void markGrownRect(FleetPacker*, PackedShip*, int);
+int64_t getMonotonicMillis();
+enum PackResult packShipsAt(FleetPacker*, int, int, int);
+enum PackResult packFleetFrom(FleetPacker*, int, int);
+enum PackResult packFleet(FleetPacker*);
+int getPackedLayout(FleetPacker*, Player*, AIPlacement*);
+int sampleGreedyLayout(PlacementGenerator*, Player*, AIPlacement*);
+void aiPutShip(Player*, Game*, int, PlacementCandidate);
+void aiPlaceShipsRandomly(Player*, Game*);
+
+/* ============
+ * AI targeting
+ * ============*/
+void initTargetingEngine(TargetingEngine*, Game*, int);
+enum TargetKnowledge getInitialKnowledge(TargetingEngine*, int, int);
+int64_t getPlacementWeight(TargetingEngine*, int, int, int, int, int);
+void addPlacementDensity(TargetingEngine*, int, int, int, int, int, int64_t);
+void rebuildTargetingDensity(TargetingEngine*);
+void addDensityThrough(TargetingEngine*, int, int, int);
+void setTargetKnowledge(TargetingEngine*, int, int, enum TargetKnowledge);
+void recordTargetingShot(TargetingEngine*, int, int);
+int chooseTarget(TargetingEngine*, Ship*, Rectangle, Point*);
+int chooseSparseTarget(TargetingEngine*, Ship*, Rectangle, Point*);
+
+/* ===============
+ * Binary snapshot
+ * ===============*/
+void writeSnapshot(Game*, FrameBuffer*);
+int isSnapshotValid(const char*, size_t);
+void loadSnapshot(Game*, const char*);
+
+/* ===========
+ * Server mode
+ * ===========*/
+int handleLine(Game*, char*);
+int isAIToMove(Game*);
+int hasGameEnded(Game*);
+void runSingleGame(LineReader*);
+void handleServerLine(StringMap*, char*);
+void finishServerGames(StringMap*);
+void* runShard(void*);
+void runServer(LineReader*, int);
+
 /* ===================================================================================================================*/
-int main() {
+// Benchmark links the engine with its own main
+#ifndef CBATTLESHIPS_NO_MAIN
+int main(int argc, char** argv) {
+    int isServer = false;
+    int threadsCount = 1;
+    int shouldPrintStats = false;
+    for(int argI = 1; argI < argc; argI++) {
+        if(strcmp(argv[argI], "--server") == 0) {
+            isServer = true;
+        } else if(strcmp(argv[argI], "--stats") == 0) {
+#ifdef CBATTLESHIPS_STATS
+            shouldPrintStats = true;
+#else
+            fputs("--stats needs a build with CBATTLESHIPS_STATS, it is ignored\n", stderr);
+#endif
+        } else if(strcmp(argv[argI], "--threads") == 0 && argI + 1 < argc) {
+            threadsCount = atoi(argv[++argI]);
+        }
+    }
+    if(threadsCount < 1) threadsCount = 1;
+
+    LineReader reader;
+    initLineReader(&reader, STDIN_FILENO);
+
+    if(isServer) {
+        runServer(&reader, threadsCount);
+    } else {
+        runSingleGame(&reader);
+    }
+
+    freeLineReader(&reader);
+
+    // AI moves after the last line, so only stats printed at exit count it
+#ifdef CBATTLESHIPS_STATS
+    if(shouldPrintStats) {
+        char text[STATS_TEXT_SIZE];
+        formatStats(text, sizeof(text));
+        fputs(text, stderr);
+    }
+#else
+    (void) shouldPrintStats;
+#endif
+    return 0;
+}
+#endif
+
+// Returns 1 if the line ended the game with an error, temporaries of the command are released after it
+int handleLine(Game* game, char* line) {
+    if(handleGroup(line, game)) return 0;
+
+    Command* cmd = &game->session->command;
+    formCommand(cmd, game, line);
+    int anyErrors = handleCommand(cmd, game);
+    resetArena(&game->session->scratch);
+    return anyErrors;
+}
+
+// AI moves once the input has ended outside any group and it is its turn
+int isAIToMove(Game* game) {
+    Player* nextPlayer = &game->players[game->nextPlayerIndex];
+    return !game->isInsideGroup && nextPlayer->isAI;
+}
+
+int hasGameEnded(Game* game) {
+    return game->shouldEnd;
+}
+
+void runSingleGame(LineReader* reader) {
     Game* game = initGame();
-    char* line = (char*) malloc(sizeof(char) * LINE_MAX_SIZE);
+    char* line;
 
-    long chars = readLine(line);
+    long chars = readLine(reader, &line);
     while(chars != EOF && (!game->shouldEnd)) {
-        if(!handleGroup(line, game)) {
-            Command* cmd = (Command*) malloc(sizeof(Command));
-            formCommand(cmd, game->groupName, line);
+        int anyErrors = handleLine(game, line);
+        flushGameOutput(game);
+        if(anyErrors) break;
 
-            int anyErrors = handleCommand(cmd, game);
-            if(anyErrors) break;
+        chars = readLine(reader, &line);
+    }
+
+    if(chars == EOF && isAIToMove(game)) {
+        handleAI(game);
+    }
+
+    freeGame(game);
+}
 
-            free(cmd->commandArgs - 1);
-            free(cmd);
+/* Every line starts with id of the game it belongs to, separated by a space from the rest
+ * of the line, which is handled like a line of a single game. Game is created by its first
+ * line and freed once it ends, later lines of an ended game are ignored. */
+void handleServerLine(StringMap* games, char* line) {
+    char* separator = strchr(line, ' ');
+    if(separator == NULL || separator == line) return;
+    *separator = '\0';
+
+    int gameI = stringMapFind(games, line);
+    if(gameI == -1) {
+        gameI = stringMapAdd(games, line, initGame());
+        ((Game*) games->values[gameI])->session->outputPrefix = games->keys[gameI];
+    }
+
+    Game* game = games->values[gameI];
+    if(game == NULL) return;
+
+    int anyErrors = handleLine(game, separator + 1);
+    flushGameOutput(game);
+    if(anyErrors || game->shouldEnd) {
+        freeGame(game);
+        games->values[gameI] = NULL;
+    }
+}
+
+// Games are finished in the order they were started
+void finishServerGames(StringMap* games) {
+    for(int gameI = 0; gameI < games->length; gameI++) {
+        Game* game = games->values[gameI];
+        if(game == NULL) continue;
+        if(isAIToMove(game)) handleAI(game);
+        freeGame(game);
+    }
+    freeStringMap(games);
+}
+
+void* runShard(void* arg) {
+    Shard* shard = (Shard*) arg;
+    LineBatch batch;
+    while(popBatch(&shard->queue, &batch)) {
+        size_t lineStart = 0;
+        while(lineStart < batch.length) {
+            char* line = batch.data + lineStart;
+            lineStart += strlen(line) + 1;
+            handleServerLine(&shard->games, line);
         }
+        freeLineBatch(&batch);
+    }
+    finishServerGames(&shard->games);
+    return NULL;
+}
 
-        chars = readLine(line);
+/* Every game belongs to the shard chosen by hash of its id, so lines of a game are handled
+ * in order by a single thread. Lines are passed to shards in batches, which are handed over
+ * when they are big enough or when the input has no more lines ready. */
+void runServer(LineReader* reader, int shardsCount) {
+    Shard* shards = (Shard*) malloc(shardsCount * sizeof(Shard));
+    LineBatch* pending = (LineBatch*) malloc(shardsCount * sizeof(LineBatch));
+    for(int shardI = 0; shardI < shardsCount; shardI++) {
+        initBatchQueue(&shards[shardI].queue, SERVER_QUEUE_CAPACITY);
+        initStringMap(&shards[shardI].games);
+        initLineBatch(&pending[shardI]);
+        pthread_create(&shards[shardI].thread, NULL, runShard, &shards[shardI]);
     }
 
-    Player* nextPlayer = game->players[game->nextPlayerIndex];
-    if(chars == EOF && !game->isInsideGroup && nextPlayer->isAI) {
-        // AI should be executed here
-        handleAI(game);
+    char* line;
+    while(readLine(reader, &line) != EOF) {
+        char* separator = strchr(line, ' ');
+        if(separator == NULL || separator == line) continue;
+
+        *separator = '\0';
+        int shardI = (int) (hashString(line) % shardsCount);
+        *separator = ' ';
+
+        appendLineToBatch(&pending[shardI], line, strlen(line));
+        if(pending[shardI].length >= SERVER_BATCH_SIZE) {
+            pushBatch(&shards[shardI].queue, &pending[shardI]);
+        }
+
+        if(!hasBufferedLine(reader)) {
+            for(shardI = 0; shardI < shardsCount; shardI++) {
+                if(pending[shardI].length > 0) pushBatch(&shards[shardI].queue, &pending[shardI]);
+            }
+        }
     }
 
-    freeGame(game);
-    free(line);
-    return 0;
+    for(int shardI = 0; shardI < shardsCount; shardI++) {
+        if(pending[shardI].length > 0) pushBatch(&shards[shardI].queue, &pending[shardI]);
+        closeBatchQueue(&shards[shardI].queue);
+    }
+    for(int shardI = 0; shardI < shardsCount; shardI++) {
+        pthread_join(shards[shardI].thread, NULL);
+        freeBatchQueue(&shards[shardI].queue);
+    }
+    free(pending);
+    free(shards);
 }
 /* ===================================================================================================================*/
 
+_Static_assert(sizeof(PrngState) == SNAPSHOT_RANDOM_STATE_SIZE, "random state has to fit the snapshot");
+
+// Whole snapshot is composed in the frame in one pass over the game
+void writeSnapshot(Game* game, FrameBuffer* snapshot) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.planeSizeY = game->planeSizeY;
+    header.planeSizeX = game->planeSizeX;
+    header.nextPlayerIndex = game->nextPlayerIndex;
+    header.extendedShips = game->extendedShips;
+    header.randomSeed = game->randomSeed;
+    header.wasSeedGiven = game->wasSeedGiven;
+    header.wasStateGiven = game->wasStateGiven;
+    memcpy(header.randomState, &game->randomState, SNAPSHOT_RANDOM_STATE_SIZE);
+    header.reefsCount = game->reefsCount;
+
+    SnapshotPlayer players[PLAYERS_COUNT];
+    int shotsCount = 0;
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        Player* player = &game->players[playerI];
+        // Negative counts are stored as they are, but classes with them have no ship records
+        for(int classI = 0; classI < TYPES_COUNT; classI++) {
+            players[playerI].typesCounts[classI] = player->typesCounts[classI];
+        }
+        header.shipsCount += getFleetShipsCount(&player->fleet);
+        for(int carrierId = 0; carrierId < player->fleet.classStarts[CARRIERS + 1]; carrierId++) {
+            header.spyPlanesCount += player->fleet.spyPlanesCounts[carrierId];
+        }
+        players[playerI].initArea[0] = player->initArea.start.y;
+        players[playerI].initArea[1] = player->initArea.start.x;
+        players[playerI].initArea[2] = player->initArea.end.y;
+        players[playerI].initArea[3] = player->initArea.end.x;
+        players[playerI].hasShoot = player->hasShoot;
+        players[playerI].isAI = player->isAI;
+        players[playerI].shotsCount = countBitboardBits(&game->shotsMaps[playerI]);
+        shotsCount += players[playerI].shotsCount;
+    }
+
+    reserveFrameBuffer(snapshot, sizeof(SnapshotHeader) + sizeof(players)
+                                 + header.shipsCount * sizeof(SnapshotShip)
+                                 + (header.reefsCount + header.spyPlanesCount + shotsCount) * sizeof(SnapshotPoint));
+    memcpy(snapshot->data + snapshot->length, &header, sizeof(header));
+    snapshot->length += sizeof(header);
+    memcpy(snapshot->data + snapshot->length, players, sizeof(players));
+    snapshot->length += sizeof(players);
+
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        Fleet* fleet = &game->players[playerI].fleet;
+        for(int classI = 0; classI < TYPES_COUNT; classI++) {
+            for(int shipI = 0; shipI < game->players[playerI].typesCounts[classI]; shipI++) {
+                int shipId = fleet->classStarts[classI] + shipI;
+                Ship ship = getFleetShip(fleet, shipId);
+                SnapshotShip record = {
+                    playerI, classI, shipI, ship.headPos.y, ship.headPos.x, ship.direction,
+                    (fleet->flags[shipId] & SHIP_PLACED) != 0, (unsigned char) ship.shots,
+                    fleet->timesMoved[shipId], fleet->shotsThisTurn[shipId], ship.spyPlanesCount
+                };
+                memcpy(snapshot->data + snapshot->length, &record, sizeof(record));
+                snapshot->length += sizeof(record);
+            }
+        }
+    }
+
+    for(int reefI = 0; reefI < game->reefsCount; reefI++) {
+        SnapshotPoint point = {game->reefs[reefI].y, game->reefs[reefI].x};
+        memcpy(snapshot->data + snapshot->length, &point, sizeof(point));
+        snapshot->length += sizeof(point);
+    }
+
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        Fleet* fleet = &game->players[playerI].fleet;
+        for(int carrierId = 0; carrierId < fleet->classStarts[CARRIERS + 1]; carrierId++) {
+            for(int spyI = 0; spyI < fleet->spyPlanesCounts[carrierId]; spyI++) {
+                Point spyPlane = fleet->spyPlanes[carrierId * MAX_SPY_PLANES + spyI];
+                SnapshotPoint point = {spyPlane.y, spyPlane.x};
+                memcpy(snapshot->data + snapshot->length, &point, sizeof(point));
+                snapshot->length += sizeof(point);
+            }
+        }
+    }
+
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        BitboardCursor cursor;
+        initBitboardCursor(&cursor);
+        int y, x;
+        while(nextBitboardBit(&game->shotsMaps[playerI], &cursor, &y, &x)) {
+            SnapshotPoint point = {y, x};
+            memcpy(snapshot->data + snapshot->length, &point, sizeof(point));
+            snapshot->length += sizeof(point);
+        }
+    }
+}
+
+// Everything loadSnapshot relies on is checked here, so it can read the snapshot in place
+int isSnapshotValid(const char* data, size_t size) {
+    if(size < sizeof(SnapshotHeader)) return false;
+    const SnapshotHeader* header = (const SnapshotHeader*) data;
+    if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) return false;
+    if(header->version != SNAPSHOT_VERSION || header->headerSize != sizeof(SnapshotHeader)) return false;
+    if(header->shipsCount < 0) return false;
+    if(header->reefsCount < 0 || header->spyPlanesCount < 0) return false;
+    if(header->nextPlayerIndex < 0 || header->nextPlayerIndex >= PLAYERS_COUNT) return false;
+
+    PrngState randomState;
+    memcpy(&randomState, header->randomState, SNAPSHOT_RANDOM_STATE_SIZE);
+    if(!isPrngStateValid(&randomState)) return false;
+
+    if(size < sizeof(SnapshotHeader) + PLAYERS_COUNT * sizeof(SnapshotPlayer)) return false;
+    const SnapshotPlayer* players = (const SnapshotPlayer*) (data + sizeof(SnapshotHeader));
+    int64_t shotsCount = 0;
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        if(players[playerI].shotsCount < 0) return false;
+        shotsCount += players[playerI].shotsCount;
+    }
+
+    size_t expectedSize = sizeof(SnapshotHeader) + PLAYERS_COUNT * sizeof(SnapshotPlayer)
+                          + (size_t) header->shipsCount * sizeof(SnapshotShip)
+                          + ((size_t) header->reefsCount + header->spyPlanesCount + shotsCount) * sizeof(SnapshotPoint);
+    if(size != expectedSize) return false;
+
+    // Size of the snapshot bounds the count of ships, the fleet grows to any of them
+    int64_t shipsCount = 0;
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        for(int classI = 0; classI < TYPES_COUNT; classI++) {
+            int typeCount = players[playerI].typesCounts[classI];
+            if(typeCount > 0) shipsCount += typeCount;
+        }
+    }
+    if(shipsCount != header->shipsCount) return false;
+
+    const SnapshotShip* ships = (const SnapshotShip*) (players + PLAYERS_COUNT);
+    int64_t spyPlanesCount = 0;
+    for(int shipI = 0; shipI < header->shipsCount; shipI++) {
+        const SnapshotShip* ship = &ships[shipI];
+        if(ship->playerIndex < 0 || ship->playerIndex >= PLAYERS_COUNT) return false;
+        if(ship->classIndex < 0 || ship->classIndex >= TYPES_COUNT) return false;
+        if(ship->shipIndex < 0 || ship->shipIndex >= players[ship->playerIndex].typesCounts[ship->classIndex]) {
+            return false;
+        }
+        int isDirectionKnown = false;
+        for(int directionI = 0; directionI < DIRECTIONS_COUNT; directionI++) {
+            if(ship->direction == (int32_t) directions[directionI]) isDirectionKnown = true;
+        }
+        if(!isDirectionKnown) return false;
+        if(ship->spyPlanesCount < 0 || ship->spyPlanesCount > MAX_SPY_PLANES) return false;
+        // Only carriers have spy plane slots
+        if(ship->classIndex != CARRIERS && ship->spyPlanesCount > 0) return false;
+        spyPlanesCount += ship->spyPlanesCount;
+    }
+    return spyPlanesCount == header->spyPlanesCount;
+}
+
+// Group state and print buffers are left untouched, everything else is replaced
+void loadSnapshot(Game* game, const char* data) {
+    const SnapshotHeader* header = (const SnapshotHeader*) data;
+    const SnapshotPlayer* players = (const SnapshotPlayer*) (data + sizeof(SnapshotHeader));
+    const SnapshotShip* ships = (const SnapshotShip*) (players + PLAYERS_COUNT);
+    const SnapshotPoint* reefs = (const SnapshotPoint*) (ships + header->shipsCount);
+    const SnapshotPoint* spyPlanes = reefs + header->reefsCount;
+    const SnapshotPoint* shots = spyPlanes + header->spyPlanesCount;
+
+    game->planeSizeY = header->planeSizeY;
+    game->planeSizeX = header->planeSizeX;
+    game->nextPlayerIndex = header->nextPlayerIndex;
+    game->extendedShips = header->extendedShips;
+    game->randomSeed = header->randomSeed;
+    game->wasSeedGiven = header->wasSeedGiven;
+    game->wasStateGiven = header->wasStateGiven;
+    memcpy(&game->randomState, header->randomState, SNAPSHOT_RANDOM_STATE_SIZE);
+
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        Player* player = &game->players[playerI];
+        updateTypesCounts(player, players[playerI].typesCounts);
+        player->initArea.start.y = players[playerI].initArea[0];
+        player->initArea.start.x = players[playerI].initArea[1];
+        player->initArea.end.y = players[playerI].initArea[2];
+        player->initArea.end.x = players[playerI].initArea[3];
+        player->hasShoot = players[playerI].hasShoot;
+        player->isAI = players[playerI].isAI;
+    }
+
+    for(int recordI = 0; recordI < header->shipsCount; recordI++) {
+        const SnapshotShip* record = &ships[recordI];
+        Fleet* fleet = &game->players[record->playerIndex].fleet;
+        int shipId = getFleetShipId(fleet, record->classIndex, record->shipIndex);
+        fleet->heads[shipId] = pointOf(record->headY, record->headX);
+        fleet->directions[shipId] = (unsigned char) record->direction;
+        fleet->flags[shipId] = record->isPlaced ? SHIP_PLACED : 0;
+        fleet->shots[shipId] = (unsigned char) record->shots;
+        fleet->timesMoved[shipId] = record->timesMoved;
+        fleet->shotsThisTurn[shipId] = record->shotThisTurn;
+        if(record->classIndex == CARRIERS) fleet->spyPlanesCounts[shipId] = record->spyPlanesCount;
+        for(int spyI = 0; spyI < record->spyPlanesCount; spyI++) {
+            fleet->spyPlanes[shipId * MAX_SPY_PLANES + spyI] = pointOf(spyPlanes->y, spyPlanes->x);
+            spyPlanes++;
+        }
+    }
+
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        recountRemainingParts(&game->players[playerI]);
+    }
+
+    // Board size may have changed, so the arena is laid out again with the loaded reefs
+    int reefsCapacity = INITIAL_REEFS_CAPACITY;
+    while(reefsCapacity < header->reefsCount) reefsCapacity *= 2;
+    game->reefsCount = 0;
+    layoutBoardArena(game, reefsCapacity);
+    for(int reefI = 0; reefI < header->reefsCount; reefI++) {
+        game->reefs[reefI] = pointOf(reefs[reefI].y, reefs[reefI].x);
+    }
+    game->reefsCount = header->reefsCount;
+    rebuildReefMap(game);
+
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        clearBitboard(&game->shotsMaps[playerI]);
+        for(int shotI = 0; shotI < players[playerI].shotsCount; shotI++) {
+            if(isInsideBoard(game, shots->y, shots->x)) setBitboardBit(&game->shotsMaps[playerI], shots->y, shots->x);
+            shots++;
+        }
+    }
+}
+
 void freeGame(Game* game) {
-    freeAllSpyPlanes(game);
-    free(game->players[0]);
-    free(game->players[1]);
-    free(game->players);
-    free(game->reefs->ptr);
-    free(game->reefs);
+    freeGameSession(game->session);
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        freeFleet(&game->players[playerI].fleet);
+    }
+    freeSparseBoard(game, true);
+    clearTileMap(&game->offBoardPartTiles);
+    free(game->boardArena);
     free(game);
 }
 
-int splitStringIntoWords(char* strToSplit, char** wordsOut) {
+// Words are separated by single spaces and terminated in place, at most maxWords are returned
+int splitStringIntoWords(char* strToSplit, char** wordsOut, int maxWords) {
     unsigned long strLength = strlen(strToSplit);
 
     // Remove spaces at the start and at the end
     while(strToSplit[0] == ' ') strToSplit++, strLength--;
-    while(strToSplit[strLength - 1] == ' ') strToSplit[strLength - 1] = '\0', strLength--;
+    while(strLength > 0 && strToSplit[strLength - 1] == ' ') strToSplit[strLength - 1] = '\0', strLength--;
+    if(strLength == 0) return 0;
 
-    strToSplit[strLength] = ' ';
-    strToSplit[strLength + 1] = '\0';
     int wordsCount = 0;
-    int currentLength = 0;
-    for(int i = 0; strToSplit[i] != '\0'; i++) {
+    wordsOut[wordsCount++] = strToSplit;
+    for(unsigned long i = 0; i < strLength; i++) {
         if(strToSplit[i] == ' ') {
             strToSplit[i] = '\0';
-            wordsOut[wordsCount] = strToSplit + (i - currentLength);
-            currentLength = 0;
-            wordsCount++;
-        } else {
-            currentLength++;
+            if(wordsCount == maxWords) break;
+            wordsOut[wordsCount++] = strToSplit + i + 1;
         }
     }
 
     return wordsCount;
 }
 
-// Return 0 or -1 if there was nothing to read
-int readLine(char* line) {
-    int readChars = 0;
-    int readChar = getchar();
+void printErrorFromLine(char* line, Game* game, char* reason) {
+    unsigned long lineLen = strlen(line);
+    char* suffix = (lineLen > 0 && line[lineLen - 1] == ']') ? " " : "";
+    gamePrintf(game, "INVALID OPERATION \"%s%s\": %s\n", line, suffix, reason);
+}
 
-    while(readChar != '\n' && readChar != EOF) {
-        line[readChars++] = (char) readChar;
-        readChar = getchar();
-    }
+void printError(Command* cmd, Game* game, char* reason) {
+    gamePrintf(game, "INVALID OPERATION \"%s\": %s\n", cmd->line, reason);
+}
 
-    line[readChars] = '\0';
+void gamePrintf(Game* game, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
 
-    if(readChar == EOF) return -1;
-    return 0;
+    FrameBuffer* output = &game->session->output;
+    reserveFrameBuffer(output, length + 1);
+    va_start(args, format);
+    vsnprintf(output->data + output->length, length + 1, format, args);
+    va_end(args);
+    output->length += length;
 }
 
-void getLineFromCmd(Command* cmd, char* line) {
-    unsigned long offset = 0;
-    unsigned long cmdNameLen = strlen(cmd->commandName);
-    for(unsigned int i = 0; i < cmdNameLen; i++) {
-        line[i] = cmd->commandName[i];
-        offset++;
-    }
-    line[offset++] = ' ';
-    for(int argN = 0; argN < cmd->argsCount; argN++) {
-        unsigned long argLen = strlen(cmd->commandArgs[argN]);
-        strcpy(line + offset, cmd->commandArgs[argN]);
-        offset += argLen;
-        line[offset++] = ' ';
+/* In server mode every line is prefixed with id of the game, so outputs of games can be told apart.
+ * Output is written with a single call, so outputs of games handled by other threads do not interleave. */
+void flushGameOutput(Game* game) {
+    FrameBuffer* output = &game->session->output;
+    if(output->length == 0) return;
+
+    if(game->session->outputPrefix == NULL) {
+        fwrite(output->data, sizeof(char), output->length, stdout);
+    } else {
+        FrameBuffer* prefixed = &game->session->prefixedOutput;
+        size_t prefixLength = strlen(game->session->outputPrefix);
+        prefixed->length = 0;
+
+        size_t lineStart = 0;
+        while(lineStart < output->length) {
+            char* lineEnd = memchr(output->data + lineStart, '\n', output->length - lineStart);
+            size_t lineLength = lineEnd != NULL ? (size_t) (lineEnd - output->data) - lineStart + 1
+                                                : output->length - lineStart;
+            reserveFrameBuffer(prefixed, prefixLength + 1 + lineLength);
+            memcpy(prefixed->data + prefixed->length, game->session->outputPrefix, prefixLength);
+            prefixed->length += prefixLength;
+            prefixed->data[prefixed->length++] = ' ';
+            memcpy(prefixed->data + prefixed->length, output->data + lineStart, lineLength);
+            prefixed->length += lineLength;
+            lineStart += lineLength;
+        }
+        fwrite(prefixed->data, sizeof(char), prefixed->length, stdout);
     }
-    line[--offset] = '\0';
+    output->length = 0;
 }
 
-void printErrorFromLine(char* line, char* reason) {
-    unsigned long lineLen = strlen(line);
-    if(line[lineLen - 1] == ']') {
-        line[lineLen] = ' ';
-        line[lineLen + 1] = '\0';
-    }
-    printf("INVALID OPERATION \"%s\": %s\n", line, reason);
+/* Every game has its own random state, so games on different threads do not share it. The generator
+ * does not depend on the C library, so the same seed gives the same game on every platform. */
+void seedGameRandom(Game* game, unsigned int seed) {
+    seedPrng(&game->randomState, seed);
 }
 
-void printError(Command* cmd, char* reason) {
-    char l[100];
-    getLineFromCmd(cmd, l);
-    printf("INVALID OPERATION \"%s\": %s\n", l, reason);
+// Non-negative like rand(), high bits of the generator are the best ones
+int gameRandom(Game* game) {
+    return (int) (nextPrng(&game->randomState) >> 33);
 }
 
 int isLineGroup(const char* str) {
     return str[0] == '[';
 }
 
-void getGroupNameFromLine(const char* line, char* readName) {
+void getGroupNameFromLine(const char* line, char* readName, int maxSize) {
     int j;
-    for (j = 1; line[j] != ']'; j++) {
+    for (j = 1; line[j] != ']' && line[j] != '\0' && j < maxSize; j++) {
         readName[j - 1] = line[j];
     }
     readName[j-1] = '\0';
 }
 
 void clearShipMovesAndShotsFor(Player* player) {
-    for(int classI = 0; classI < TYPES_COUNT; classI++) {
-        for(int shipI = 0; shipI < player->typesCounts[classI]; shipI++) {
-            player->ships[classI][shipI].timesMoved = 0;
-            player->ships[classI][shipI].shotThisTurn = 0;
-        }
+    int shipsCount = getFleetShipsCount(&player->fleet);
+    memset(player->fleet.timesMoved, 0, shipsCount * sizeof(int));
+    memset(player->fleet.shotsThisTurn, 0, shipsCount * sizeof(int));
+}
+
+// Group is resolved once when it is opened, commands only read the result
+void resolveGroupKind(Game* game) {
+    game->groupPlayerIndex = -1;
+    if(strcmp(game->groupName, "state") == 0) {
+        game->groupKind = GROUP_STATE;
+    } else if(strcmp(game->groupName, "playerA") == 0) {
+        game->groupKind = GROUP_PLAYER;
+        game->groupPlayerIndex = 0;
+    } else if(strcmp(game->groupName, "playerB") == 0) {
+        game->groupKind = GROUP_PLAYER;
+        game->groupPlayerIndex = 1;
+    } else {
+        game->groupKind = GROUP_UNKNOWN;
     }
 }
 
 // true if command handling should stop <==> line is a group statement
 int handleGroup(char* line, Game* game) {
-    char newGroupName[LINE_MAX_SIZE - 2];
+    char newGroupName[GROUP_NAME_MAX_SIZE];
     int isGroup = isLineGroup(line);
     if(isGroup) {
-        getGroupNameFromLine(line, newGroupName);
+        getGroupNameFromLine(line, newGroupName, GROUP_NAME_MAX_SIZE);
         if(game->isInsideGroup && strcmp(game->groupName, newGroupName) == 0) {
             game->isInsideGroup = false;
             if(strncmp(newGroupName, "player", 6) == 0) {
                 // PLAYER HAS ENDED HIS TURN! CHECK FOR VICTORY!
                 int playerIndex = newGroupName[6] == 'A' ? 0 : 1;
-                Player* currentPlayer = game->players[playerIndex];
+                Player* currentPlayer = &game->players[playerIndex];
                 clearShipMovesAndShotsFor(currentPlayer);
 
-                int remainingCount = getPlayerRemainingCount(game->players[game->nextPlayerIndex]);
+                int remainingCount = getPlayerRemainingCount(&game->players[game->nextPlayerIndex]);
                 if(remainingCount == 0 && areAllShipsPlaced(game->players)) {
-                    printf("%c won\n", newGroupName[6]);
+                    gamePrintf(game, "%c won\n", newGroupName[6]);
                     game->shouldEnd = 1;
                 }
             }
         } else if(game->isInsideGroup) {
-            printErrorFromLine(line, "THE OTHER PLAYER EXPECTED");
+            printErrorFromLine(line, game, "THE OTHER PLAYER EXPECTED");
             game->shouldEnd = 1;
         } else {
             if(strncmp(newGroupName, "player", 6) == 0) {
                 if(!updateNextPlayer(line, newGroupName, game)) return isGroup;
             }
             strcpy(game->groupName, newGroupName);
+            resolveGroupKind(game);
             game->isInsideGroup = true;
         }
     }
@@ -307,7 +1055,7 @@ int updateNextPlayer(char* line, const char* newGroupName, Game* game) {
     char playerX = newGroupName[6];
     if(playerX == 'A') {
         if(game->nextPlayerIndex != 0) {
-            printErrorFromLine(line, "THE OTHER PLAYER EXPECTED");
+            printErrorFromLine(line, game, "THE OTHER PLAYER EXPECTED");
             game->shouldEnd = 1;
             return 0;
         } else {
@@ -315,7 +1063,7 @@ int updateNextPlayer(char* line, const char* newGroupName, Game* game) {
         }
     } else {
         if (game->nextPlayerIndex != 1) {
-            printErrorFromLine(line, "THE OTHER PLAYER EXPECTED");
+            printErrorFromLine(line, game, "THE OTHER PLAYER EXPECTED");
             game->shouldEnd = 1;
             return 0;
         } else {
@@ -325,7 +1073,7 @@ int updateNextPlayer(char* line, const char* newGroupName, Game* game) {
 
     // Player updated, check if new player is A.I.
     // If so then execute A.I. function
-//    Player* currentPlayer = game->players[getIndexOfPlayerChar(playerX)];
+//    Player* currentPlayer = &game->players[getIndexOfPlayerChar(playerX)];
 //    if(currentPlayer->isAI) {
 //        handleAI(game, currentPlayer);
 //    } DIDN'T WORK
@@ -333,128 +1081,356 @@ int updateNextPlayer(char* line, const char* newGroupName, Game* game) {
     return 1;
 }
 
-void formCommand(Command* readBuffer, char* groupName, char* line) {
-    char** commandElements = (char**) malloc(MAX_CMD_ELEMENTS * sizeof(char*));
-    int argsCount = splitStringIntoWords(line, commandElements) - 1;
-    char* commandName = commandElements[0];
-    char** commandArgs = commandElements + 1;
-    Command cmd;
-    cmd.commandGroup = groupName;
-    cmd.commandName = commandName;
-    cmd.commandArgs = commandArgs;
-    cmd.argsCount = argsCount;
-    *readBuffer = cmd;
+// Converts like atoi, but values out of int range are clamped instead of being undefined
+int parseIntArg(const char* arg) {
+    long value = strtol(arg, NULL, 10);
+    if(value > INT_MAX) return INT_MAX;
+    if(value < INT_MIN) return INT_MIN;
+    return (int) value;
 }
 
+// Words are copied into the scratch arena of the game, so the line itself stays intact for error
+// messages, they live until the command has been handled
+void formCommand(Command* cmd, Game* game, char* line) {
+    // Remove spaces at the start and at the end
+    while(line[0] == ' ') line++;
+    size_t lineLen = strlen(line);
+    while(lineLen > 0 && line[lineLen - 1] == ' ') line[--lineLen] = '\0';
+
+    char* words = (char*) arenaAlloc(&game->session->scratch, lineLen + 1);
+    memcpy(words, line, lineLen + 1);
+
+    char* commandElements[MAX_CMD_ELEMENTS];
+    int wordsCount = splitStringIntoWords(words, commandElements, MAX_CMD_ELEMENTS);
+    if(wordsCount == 0) commandElements[wordsCount++] = words;
+
+    cmd->groupKind = game->groupKind;
+    cmd->kind = getCommandKind(commandElements[0]);
+    cmd->playerIndex = game->groupPlayerIndex;
+    cmd->line = line;
+    cmd->commandName = commandElements[0];
+    cmd->argsCount = wordsCount - 1;
+
+    // Missing arguments are read as empty words
+    for(int argN = 0; argN < MAX_CMD_ARGS; argN++) {
+        if(argN < cmd->argsCount) {
+            cmd->commandArgs[argN] = commandElements[argN + 1];
+            cmd->intArgs[argN] = parseIntArg(cmd->commandArgs[argN]);
+        } else {
+            cmd->commandArgs[argN] = "";
+            cmd->intArgs[argN] = 0;
+        }
+    }
+}
+
+// Keyword switch, every name is confirmed with a single comparison at most
+enum CommandKind getCommandKind(const char* name) {
+    enum CommandKind candidate = CMD_UNKNOWN;
+    const char* keyword = "";
+    switch(name[0]) {
+        case 'B':
+            candidate = CMD_BOARD_SIZE, keyword = "BOARD_SIZE";
+            break;
+        case 'E':
+            candidate = CMD_EXTENDED_SHIPS, keyword = "EXTENDED_SHIPS";
+            break;
+        case 'I':
+            candidate = CMD_INIT_POSITION, keyword = "INIT_POSITION";
+            break;
+        case 'L':
+            candidate = CMD_LOAD_BINARY, keyword = "LOAD_BINARY";
+            break;
+        case 'M':
+            candidate = CMD_MOVE, keyword = "MOVE";
+            break;
+        case 'N':
+            candidate = CMD_NEXT_PLAYER, keyword = "NEXT_PLAYER";
+            break;
+        case 'P':
+            if(name[1] == 'R') candidate = CMD_PRINT, keyword = "PRINT";
+            else candidate = CMD_PLACE_SHIP, keyword = "PLACE_SHIP";
+            break;
+        case 'R':
+            if(name[1] == 'A') candidate = CMD_RANDOM_STATE, keyword = "RANDOM_STATE";
+            else candidate = CMD_REEF, keyword = "REEF";
+            break;
+        case 'S':
+            switch(name[1]) {
+                case 'A':
+                    if(name[4] == '_') candidate = CMD_SAVE_BINARY, keyword = "SAVE_BINARY";
+                    else candidate = CMD_SAVE, keyword = "SAVE";
+                    break;
+                case 'E':
+                    if(name[2] == 'T' && name[3] == '_' && name[4] == 'A') {
+                        candidate = CMD_SET_AI_PLAYER, keyword = "SET_AI_PLAYER";
+                    } else {
+                        candidate = CMD_SET_FLEET, keyword = "SET_FLEET";
+                    }
+                    break;
+                case 'H':
+                    if(name[2] == 'I') candidate = CMD_SHIP, keyword = "SHIP";
+                    else candidate = CMD_SHOOT, keyword = "SHOOT";
+                    break;
+                case 'P':
+                    candidate = CMD_SPY, keyword = "SPY";
+                    break;
+                case 'R':
+                    candidate = CMD_SRAND, keyword = "SRAND";
+                    break;
+                case 'T':
+                    candidate = CMD_STATS, keyword = "STATS";
+                    break;
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if(strcmp(name, keyword) != 0) return CMD_UNKNOWN;
+    return candidate;
+}
+
+const CommandHandler commandHandlers[GROUP_KINDS_COUNT][COMMAND_KINDS_COUNT] = {
+    [GROUP_STATE] = {
+        [CMD_PRINT] = statePrint,
+        [CMD_SET_FLEET] = setFleet,
+        [CMD_NEXT_PLAYER] = setNextPlayer,
+        [CMD_BOARD_SIZE] = setBoardSize,
+        [CMD_INIT_POSITION] = setInitPos,
+        [CMD_REEF] = addReef,
+        [CMD_SHIP] = shipCommand,
+        [CMD_EXTENDED_SHIPS] = setExtendedShips,
+        [CMD_SAVE] = saveCommand,
+        [CMD_SET_AI_PLAYER] = setAIPlayer,
+        [CMD_SAVE_BINARY] = saveBinaryCommand,
+        [CMD_LOAD_BINARY] = loadBinaryCommand,
+        [CMD_RANDOM_STATE] = setRandomState,
+#ifdef CBATTLESHIPS_STATS
+        [CMD_STATS] = statsCommand,
+#endif
+    },
+    [GROUP_PLAYER] = {
+        [CMD_PLACE_SHIP] = placeShip,
+        [CMD_SHOOT] = shootCommand,
+        [CMD_MOVE] = moveShip,
+        [CMD_PRINT] = playerPrint,
+        [CMD_SPY] = placeSpy,
+        [CMD_SRAND] = setSrand,
+    },
+};
+
+#ifdef CBATTLESHIPS_STATS
+// Handlers counted in the stats, shooting is counted by shootCommand, which knows the mode
+const enum StatsKind commandStatsKinds[GROUP_KINDS_COUNT][COMMAND_KINDS_COUNT] = {
+    [GROUP_STATE] = {
+        [CMD_PRINT] = STATS_STATE_PRINT,
+    },
+    [GROUP_PLAYER] = {
+        [CMD_PLACE_SHIP] = STATS_PLACE_SHIP,
+        [CMD_MOVE] = STATS_MOVE_SHIP,
+        [CMD_PRINT] = STATS_PLAYER_PRINT,
+        [CMD_SPY] = STATS_PLACE_SPY,
+    },
+};
+#endif
+
 int handleCommand(Command* commandToHandle, Game* game) {
     if(!game->isInsideGroup) return 0;
-    if(strcmp(commandToHandle->commandGroup, "state") == 0) {
-        if(strcmp(commandToHandle->commandName, "PRINT") == 0) {
-            return statePrint(commandToHandle, game);
-        } else if(strcmp(commandToHandle->commandName, "SET_FLEET") == 0) {
-            return setFleet(commandToHandle, game->players);
-        } else if(strcmp(commandToHandle->commandName, "NEXT_PLAYER") == 0) {
-            return setNextPlayer(commandToHandle, game);
-        } else if(strcmp(commandToHandle->commandName, "BOARD_SIZE") == 0) {
-            return setBoardSize(commandToHandle, game);
-        } else if(strcmp(commandToHandle->commandName, "INIT_POSITION") == 0) {
-            return setInitPos(commandToHandle, game->players);
-        } else if(strcmp(commandToHandle->commandName, "REEF") == 0) {
-           return addReef(commandToHandle, game);
-        } else if(strcmp(commandToHandle->commandName, "SHIP") == 0) {
-            return shipCommand(commandToHandle, game);
-        } else if(strcmp(commandToHandle->commandName, "EXTENDED_SHIPS") == 0) {
-            game->extendedShips = 1;
-        } else if(strcmp(commandToHandle->commandName, "SAVE") == 0) {
-            saveGame(game);
-        } else if(strcmp(commandToHandle->commandName, "SET_AI_PLAYER") == 0) {
-            return setAIPlayer(commandToHandle, game);
-        }
+    CommandHandler handler = commandHandlers[commandToHandle->groupKind][commandToHandle->kind];
+    if(handler == NULL) return 0;
+#ifdef CBATTLESHIPS_STATS
+    enum StatsKind statsKind = commandStatsKinds[commandToHandle->groupKind][commandToHandle->kind];
+    if(statsKind != STATS_NONE) return callCountedHandler(statsKind, handler, commandToHandle, game);
+#endif
+    return handler(commandToHandle, game);
+}
+
+// Without stats it is a plain call of the handler
+int callCountedHandler(enum StatsKind statsKind, CommandHandler handler, Command* cmd, Game* game) {
+    STATS_START(start);
+    int anyErrors = handler(cmd, game);
+    STATS_STOP(statsKind, start, anyErrors);
+    return anyErrors;
+}
+
+int shootCommand(Command* cmd, Game* game) {
+    if(game->extendedShips) {
+        return callCountedHandler(STATS_SHOOT_EXTENDED, shootExtended, cmd, game);
     } else {
-        if(strcmp(commandToHandle->commandName, "PLACE_SHIP") == 0) {
-            return placeShip(commandToHandle, game);
-        } else if(strcmp(commandToHandle->commandName, "SHOOT") == 0) {
-            if(game->extendedShips) {
-                return shootExtended(commandToHandle, game);
-            } else {
-                return shoot(commandToHandle, game);
-            }
-        } else if(strcmp(commandToHandle->commandName, "MOVE") == 0) {
-            return moveShip(commandToHandle, game);
-        } else if(strcmp(commandToHandle->commandName, "PRINT") == 0) {
-            return playerPrint(commandToHandle, game);
-        } else if(strcmp(commandToHandle->commandName, "SPY") == 0) {
-            return placeSpy(commandToHandle, game);
-        } else if(strcmp(commandToHandle->commandName, "SRAND") == 0) {
-            return setSrand(commandToHandle, game);
-        }
+        return callCountedHandler(STATS_SHOOT, shoot, cmd, game);
     }
+}
+
+int setExtendedShips(Command* cmd, Game* game) {
+    (void) cmd;
+    game->extendedShips = 1;
+    return 0;
+}
+
+int saveCommand(Command* cmd, Game* game) {
+    (void) cmd;
+    saveGame(game);
+    return 0;
+}
 
+#ifdef CBATTLESHIPS_STATS
+int statsCommand(Command* cmd, Game* game) {
+    (void) cmd;
+    char text[STATS_TEXT_SIZE];
+    formatStats(text, sizeof(text));
+    gamePrintf(game, "%s", text);
     return 0;
 }
+#endif
 
-int areAllShipsPlaced(Player** players) {
-    int allPlaced = 1;
+int areAllShipsPlaced(Player* players) {
     for(int playerN = 0; playerN <= 1; playerN++) {
-        for(int shipClassI = 0; shipClassI < TYPES_COUNT; shipClassI++) {
-            for(int shipIndex = 0; shipIndex < players[playerN]->typesCounts[shipClassI]; shipIndex++) {
-                if(!players[playerN]->ships[shipClassI][shipIndex].isPlaced) {
-                    allPlaced = 0;
-                    break;
-                }
-            }
+        Fleet* fleet = &players[playerN].fleet;
+        for(int shipId = 0; shipId < getFleetShipsCount(fleet); shipId++) {
+            if(!(fleet->flags[shipId] & SHIP_PLACED)) return false;
         }
     }
-    return allPlaced;
+    return true;
 }
 
 int getCurrentPlayer(Command* cmd) {
-    if(strcmp(cmd->commandGroup, "playerA") == 0) {
-        return 0;
-    } else if(strcmp(cmd->commandGroup, "playerB") == 0) {
-        return 1;
-    } else {
-        return -1;
+    return cmd->playerIndex;
+}
+
+/* Fleet has to be zeroed or initialised before. Player keeps negative counts to save them,
+ * but classes with such counts have no ships. */
+void initFleet(Fleet* fleet, const int typesCounts[TYPES_COUNT]) {
+    free(fleet->block);
+    fleet->classStarts[0] = 0;
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        int count = typesCounts[classI] > 0 ? typesCounts[classI] : 0;
+        fleet->classStarts[classI + 1] = fleet->classStarts[classI] + count;
+    }
+    fleet->blockSize = getFleetBlockSize(fleet);
+    fleet->block = (char*) malloc(fleet->blockSize > 0 ? fleet->blockSize : 1);
+    STATS_ALLOCATION(fleet->blockSize);
+    memset(fleet->block, 0, fleet->blockSize);
+    assignFleetColumns(fleet);
+
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        for(int shipId = fleet->classStarts[classI]; shipId < fleet->classStarts[classI + 1]; shipId++) {
+            fleet->heads[shipId] = pointOf(-1, -1);
+            fleet->directions[shipId] = N;
+            fleet->sizes[shipId] = (unsigned char) shipsSizes[classI];
+        }
     }
 }
 
+// Columns of 4 byte fields go first, so every column is aligned
+size_t getFleetBlockSize(Fleet* fleet) {
+    size_t shipsCount = (size_t) getFleetShipsCount(fleet);
+    size_t carriersCount = (size_t) fleet->classStarts[CARRIERS + 1];
+    return shipsCount * (sizeof(Point) + 2 * sizeof(int) + 4 * sizeof(unsigned char))
+           + carriersCount * (sizeof(int) + MAX_SPY_PLANES * sizeof(Point));
+}
+
+void assignFleetColumns(Fleet* fleet) {
+    size_t shipsCount = (size_t) getFleetShipsCount(fleet);
+    size_t carriersCount = (size_t) fleet->classStarts[CARRIERS + 1];
+    char* next = fleet->block;
+    fleet->heads = (Point*) next;
+    next += shipsCount * sizeof(Point);
+    fleet->timesMoved = (int*) next;
+    next += shipsCount * sizeof(int);
+    fleet->shotsThisTurn = (int*) next;
+    next += shipsCount * sizeof(int);
+    fleet->spyPlanesCounts = (int*) next;
+    next += carriersCount * sizeof(int);
+    fleet->spyPlanes = (Point*) next;
+    next += carriersCount * MAX_SPY_PLANES * sizeof(Point);
+    fleet->directions = (unsigned char*) next;
+    next += shipsCount;
+    fleet->sizes = (unsigned char*) next;
+    next += shipsCount;
+    fleet->shots = (unsigned char*) next;
+    next += shipsCount;
+    fleet->flags = (unsigned char*) next;
+}
+
+// Dest gets a block of its own, the block it had before is not freed
+void copyFleet(Fleet* dest, Fleet* source) {
+    *dest = *source;
+    dest->block = (char*) malloc(source->blockSize > 0 ? source->blockSize : 1);
+    STATS_ALLOCATION(source->blockSize);
+    memcpy(dest->block, source->block, source->blockSize);
+    assignFleetColumns(dest);
+}
+
+void freeFleet(Fleet* fleet) {
+    free(fleet->block);
+    fleet->block = NULL;
+    fleet->blockSize = 0;
+}
+
+int getFleetShipsCount(Fleet* fleet) {
+    return fleet->classStarts[TYPES_COUNT];
+}
+
+// Returns -1 if the class has no ship with the index
+int getFleetShipId(Fleet* fleet, int classIndex, int index) {
+    if(index < 0 || index >= fleet->classStarts[classIndex + 1] - fleet->classStarts[classIndex]) return -1;
+    return fleet->classStarts[classIndex] + index;
+}
+
+int getFleetShipClass(Fleet* fleet, int shipId) {
+    int classI = 0;
+    while(shipId >= fleet->classStarts[classI + 1]) classI++;
+    return classI;
+}
+
+Ship getFleetShip(Fleet* fleet, int shipId) {
+    Ship ship = createNewShip(fleet->sizes[shipId], shipId);
+    ship.headPos = fleet->heads[shipId];
+    ship.direction = (enum Direction) fleet->directions[shipId];
+    ship.shots = (char) fleet->shots[shipId];
+    if(shipId < fleet->classStarts[CARRIERS + 1]) {
+        ship.spyPlanes = &fleet->spyPlanes[shipId * MAX_SPY_PLANES];
+        ship.spyPlanesCount = fleet->spyPlanesCounts[shipId];
+    }
+    return ship;
+}
+
 Ship createNewShip(int size, int ID) {
     Ship s;
     s.headPos.y = -1;
     s.headPos.x = -1;
     s.direction = N;
     s.shots = 0;
-    s.isPlaced = 0;
     s.size = size;
-    s.timesMoved = 0;
-    s.shotThisTurn = 0;
     s.ID = ID;
-    initPointVec(&s.spyPlanes);
+    s.spyPlanes = NULL;
+    s.spyPlanesCount = 0;
     return s;
 }
 
-Player* createNewPlayer() {
-    Player* p = (Player*) malloc(sizeof(Player));
-    p->typesCounts[0] = 1;
-    p->typesCounts[1] = 2;
-    p->typesCounts[2] = 3;
-    p->typesCounts[3] = 4;
-    for(int i = 0; i < TYPES_COUNT; i++) {
-        for(int j = 0; j < p->typesCounts[i]; j++) {
-            p->ships[i][j] = createNewShip(shipsSizes[i], j);
-        }
-    }
-    p->hasShoot = 0;
-    p->isAI = 0;
+Player createNewPlayer() {
+    Player p;
+    memset(&p, 0, sizeof(Player));
+    p.typesCounts[0] = 1;
+    p.typesCounts[1] = 2;
+    p.typesCounts[2] = 3;
+    p.typesCounts[3] = 4;
+    initFleet(&p.fleet, p.typesCounts);
+    p.hasShoot = 0;
+    p.isAI = 0;
+    p.remainingParts = 0;
     return p;
 }
 
 Game* initGame() {
-    Game* newGame = (Game*) malloc(sizeof(Game));
+    Game* newGame = (Game*) calloc(1, sizeof(Game));
     newGame->isInsideGroup = 0;
+    newGame->groupKind = GROUP_UNKNOWN;
+    newGame->groupPlayerIndex = -1;
     newGame->nextPlayerIndex = 0;
     newGame->shouldEnd = 0;
-    newGame->players = (Player**) malloc(sizeof(Player**) * 2);
 
     Rectangle aDefaultInitArea;
     aDefaultInitArea.start.x = 0;
@@ -468,39 +1444,57 @@ Game* initGame() {
     bDefaultInitArea.start.y = 11;
     bDefaultInitArea.end.y = 20;
 
-    Player *a = createNewPlayer();
-    a->initArea = aDefaultInitArea;
-    newGame->players[0] = a;
+    newGame->players[0] = createNewPlayer();
+    newGame->players[0].initArea = aDefaultInitArea;
 
-    Player *b = createNewPlayer();
-    b->initArea = bDefaultInitArea;
-    newGame->players[1] = b;
+    newGame->players[1] = createNewPlayer();
+    newGame->players[1].initArea = bDefaultInitArea;
 
     newGame->planeSizeX = 10;
     newGame->planeSizeY = 21;
 
-    newGame->reefs = (PointVec*) malloc(sizeof(PointVec));
-    initPointVec(newGame->reefs);
+    newGame->reefs = NULL;
+    newGame->reefsCount = 0;
+    newGame->boardArena = NULL;
+    initTileMap(&newGame->offBoardPartTiles, OFF_BOARD_GRID_SIDE * OFF_BOARD_GRID_SIDE * sizeof(int), 0);
+    layoutBoardArena(newGame, INITIAL_REEFS_CAPACITY);
+
+    newGame->session = createGameSession();
 
     newGame->extendedShips = 0;
     newGame->randomSeed = 0;
     newGame->wasSeedGiven = false;
+    newGame->wasStateGiven = false;
+    seedGameRandom(newGame, 0);
 
     return newGame;
 }
 
+GameSession* createGameSession() {
+    GameSession* session = (GameSession*) malloc(sizeof(GameSession));
+    initArena(&session->scratch, SCRATCH_ARENA_BLOCK_SIZE);
+    initFrameBuffer(&session->output);
+    initFrameBuffer(&session->prefixedOutput);
+    session->outputPrefix = NULL;
+    return session;
+}
+
+void freeGameSession(GameSession* session) {
+    freeFrameBuffer(&session->output);
+    freeFrameBuffer(&session->prefixedOutput);
+    freeArena(&session->scratch);
+    free(session);
+}
+
 void updateTypesCounts(Player* dest, const int newTypesCounts[TYPES_COUNT]) {
     for(int i = 0; i < TYPES_COUNT; i++) {
         dest->typesCounts[i] = newTypesCounts[i];
     }
-    for(int i = 0; i < TYPES_COUNT; i++) {
-        for(int j = 0; j < dest->typesCounts[i]; j++) {
-            dest->ships[i][j] = createNewShip(shipsSizes[i], j);
-        }
-    }
+    initFleet(&dest->fleet, dest->typesCounts);
+    recountRemainingParts(dest);
 }
 
-int setFleet(Command* cmd, Player** players) {
+int setFleet(Command* cmd, Game* game) {
     char* playerX = cmd->commandArgs[0];
     int playerIndex;
     if(strcmp(playerX, "A") == 0) {
@@ -511,112 +1505,75 @@ int setFleet(Command* cmd, Player** players) {
 
     int newTypesCounts[4];
     for(int i = 0; i < 4; i++) {
-        newTypesCounts[i] = atoi(cmd->commandArgs[i+1]);
+        newTypesCounts[i] = cmd->intArgs[i+1];
     }
 
-    updateTypesCounts(players[playerIndex], newTypesCounts);
+    updateTypesCounts(&game->players[playerIndex], newTypesCounts);
+    // Ships of the player were recreated, so cells pointing to them are stale
+    rebuildBoardIndexes(game);
     return 0;
 }
 
+// Unknown classes are treated as carriers
 int getClassIndex(char* className) {
-    int cIndex = 0;
-    if(strcmp(className, "CAR") == 0) cIndex = CARRIERS;
-    if(strcmp(className, "BAT") == 0) cIndex = BATTLESHIPS;
-    if(strcmp(className, "CRU") == 0) cIndex = CRUISERS;
-    if(strcmp(className, "DES") == 0) cIndex = DESTROYERS;
+    int cIndex = CARRIERS;
+    switch(className[0]) {
+        case 'B':
+            if(strcmp(className, "BAT") == 0) cIndex = BATTLESHIPS;
+            break;
+        case 'C':
+            if(strcmp(className, "CRU") == 0) cIndex = CRUISERS;
+            break;
+        case 'D':
+            if(strcmp(className, "DES") == 0) cIndex = DESTROYERS;
+            break;
+        default:
+            break;
+    }
     return cIndex;
 }
 
-void getShipElementsOfPlayer(Player* p, ShipElementVec* shipElements) {
-    for(int shipType = 0; shipType < TYPES_COUNT; shipType++) {
-        int shipTypeCount = p->typesCounts[shipType];
-        for(int shipIndex = 0; shipIndex < shipTypeCount; shipIndex++) {
-            int shipSize = shipsSizes[shipType];
-            Ship ship = p->ships[shipType][shipIndex];
-            if(!ship.isPlaced) continue;
-
-            int modY = 0, modX = 0;
-            switch(ship.direction) {
-                case N:
-                {
-                    modY = 1;
-                    break;
-                }
-                case S:
-                {
-                    modY = -1;
-                    break;
-                }
-                case E:
-                {
-                    modX = -1;
-                    break;
-                }
-                case W:
-                {
-                    modX = 1;
-                    break;
-                }
-            }
-
-            int nowX = ship.headPos.x;
-            int nowY = ship.headPos.y;
-
-            int nth = 0;
-
-            for(int s = 0; s < shipSize; s++) {
-                ShipElement el;
-                el.pos.x = nowX;
-                el.pos.y = nowY;
-                el.ship = &p->ships[shipType][shipIndex];
-                el.nth = nth++;
-
-                shipElementVecPushBack(shipElements, el);
-
-                nowX += modX;
-                nowY += modY;
-            }
-        }
-    }
+// Count of not destroyed parts of placed ships is kept up to date by placement and shooting
+int getPlayerRemainingCount(Player* player) {
+    return player->remainingParts;
 }
 
-void getAllShipElements(ShipElementVec* shipElements, Player** players) {
-    for(int playerN = 0; playerN <= 1; playerN++) {
-        getShipElementsOfPlayer(players[playerN], shipElements);
+// Has to be called once ship is placed and its shots bitmask is set
+void addPlacedShipParts(Player* player, int shipId) {
+    Fleet* fleet = &player->fleet;
+    int remainingCount = 0;
+    for(int nth = 0; nth < fleet->sizes[shipId]; nth++) {
+        if(!(fleet->shots[shipId] & (1 << nth))) remainingCount++;
     }
+    player->remainingParts += remainingCount;
+    fleet->flags[shipId] &= ~SHIP_SUNK;
+    if(remainingCount == 0) fleet->flags[shipId] |= SHIP_SUNK;
 }
 
-int getPlayerRemainingCount(Player* player) {
-    ShipElementVec* elements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-    initShipElementVec(elements);
-    getShipElementsOfPlayer(player, elements);
-    // Check if nth bit of ship's shot bitmask is 0, if so then count it
-    int remainingCount = 0;
-    for(int i = 0; i < elements->length; i++) {
-        if(!(elements->ptr[i].ship->shots & (1 << elements->ptr[i].nth))) {
-            remainingCount++;
-        }
+void recountRemainingParts(Player* player) {
+    player->remainingParts = 0;
+    for(int shipId = 0; shipId < getFleetShipsCount(&player->fleet); shipId++) {
+        if(player->fleet.flags[shipId] & SHIP_PLACED) addPlacedShipParts(player, shipId);
     }
-    free(elements->ptr);
-    free(elements);
-    return remainingCount;
 }
 
 int placeShip(Command* cmd, Game* game) {
-    int y = atoi(cmd->commandArgs[0]);
-    int x = atoi(cmd->commandArgs[1]);
+    int y = cmd->intArgs[0];
+    int x = cmd->intArgs[1];
     enum Direction D = (unsigned char) cmd->commandArgs[2][0];
-    int i = atoi(cmd->commandArgs[3]);
+    int i = cmd->intArgs[3];
     char* C = cmd->commandArgs[4];
     int cIndex = getClassIndex(C);
+    Fleet* fleet = &game->players[getCurrentPlayer(cmd)].fleet;
+    int shipId = getFleetShipId(fleet, cIndex, i);
 
-    if(i >= game->players[getCurrentPlayer(cmd)]->typesCounts[cIndex]) {
-        printError(cmd, "ALL SHIPS OF THE CLASS ALREADY SET");
+    if(shipId == -1) {
+        printError(cmd, game, "ALL SHIPS OF THE CLASS ALREADY SET");
         return 1;
     }
 
-    if(game->players[getCurrentPlayer(cmd)]->ships[cIndex][i].isPlaced) {
-        printError(cmd, "SHIP ALREADY PRESENT");
+    if(fleet->flags[shipId] & SHIP_PLACED) {
+        printError(cmd, game, "SHIP ALREADY PRESENT");
         return 1;
     }
 
@@ -648,10 +1605,10 @@ int placeShip(Command* cmd, Game* game) {
     int currentPlayerIndex = getCurrentPlayer(cmd);
     int wellPlaced;
 
-    Player* currentPlayer = game->players[currentPlayerIndex];
-    currentPlayer->ships[cIndex][i].headPos.x = x;
-    currentPlayer->ships[cIndex][i].headPos.y = y;
-    currentPlayer->ships[cIndex][i].direction = D;
+    Player* currentPlayer = &game->players[currentPlayerIndex];
+    fleet->heads[shipId] = pointOf(y, x);
+    fleet->directions[shipId] = (unsigned char) D;
+    Ship ship = getFleetShip(fleet, shipId);
 
     Rectangle initArea = currentPlayer->initArea;
     wellPlaced = (y >= initArea.start.y) && (y <= initArea.end.y)
@@ -659,126 +1616,132 @@ int placeShip(Command* cmd, Game* game) {
             && (backY >= initArea.start.y) && (backY <= initArea.end.y)
             && (backX >= initArea.start.x) && (backX <= initArea.end.x);
 
-    int isOnReef = isShipOnReef(currentPlayer->ships[cIndex][i], game);
-    int isTooCloseToOther = isTooCloseToOtherShip(&currentPlayer->ships[cIndex][i], game);
+    int isOnReef = isShipOnReef(ship, game);
+    int isTooCloseToOther = isTooCloseToOtherShip(&ship, game);
 
     if(!wellPlaced) {
-        printError(cmd, "NOT IN STARTING POSITION");
+        printError(cmd, game, "NOT IN STARTING POSITION");
         return 1;
     } else if(isOnReef) {
-        printError(cmd, "PLACING SHIP ON REEF");
+        printError(cmd, game, "PLACING SHIP ON REEF");
         return 1;
     } else if(isTooCloseToOther) {
-        printError(cmd, "PLACING SHIP TOO CLOSE TO OTHER SHIP");
+        printError(cmd, game, "PLACING SHIP TOO CLOSE TO OTHER SHIP");
         return 1;
     }
 
-    currentPlayer->ships[cIndex][i].isPlaced = 1;
+    fleet->flags[shipId] |= SHIP_PLACED;
+    addPlacedShipParts(currentPlayer, shipId);
+    addShipToBoard(game, currentPlayerIndex, &ship);
 
     return 0;
 }
 
 int shipCommand(Command* cmd, Game* game) {
     char playerX = cmd->commandArgs[0][0];
-    Player* player = game->players[playerX == 'A' ? 0 : 1];
-    int y = atoi(cmd->commandArgs[1]);
-    int x = atoi(cmd->commandArgs[2]);
+    Player* player = &game->players[playerX == 'A' ? 0 : 1];
+    int y = cmd->intArgs[1];
+    int x = cmd->intArgs[2];
     enum Direction D = (unsigned char) cmd->commandArgs[3][0];
-    int i = atoi(cmd->commandArgs[4]);
+    int i = cmd->intArgs[4];
     char* C = cmd->commandArgs[5];
     int cIndex = getClassIndex(C);
     char* bitmask = cmd->commandArgs[6];
+    Fleet* fleet = &player->fleet;
+    int shipId = getFleetShipId(fleet, cIndex, i);
 
-    if(i >= player->typesCounts[cIndex]) {
-        printError(cmd, "ALL SHIPS OF THE CLASS ALREADY SET");
+    if(shipId == -1) {
+        printError(cmd, game, "ALL SHIPS OF THE CLASS ALREADY SET");
         return 1;
     }
 
     Point headPos;
     headPos.y = y;
     headPos.x = x;
-    player->ships[cIndex][i].headPos = headPos;
+    fleet->heads[shipId] = headPos;
+    Ship ship = getFleetShip(fleet, shipId);
 
-    int isAlreadyPlaced = player->ships[cIndex][i].isPlaced;
-    int isOnReef = isShipOnReef(player->ships[cIndex][i], game);
-    int isTooCloseToOther = isTooCloseToOtherShip(&player->ships[cIndex][i], game);
+    int isAlreadyPlaced = fleet->flags[shipId] & SHIP_PLACED;
+    int isOnReef = isShipOnReef(ship, game);
+    // Already placed ship has just been moved onto the checked position, so it always collides with itself
+    int isTooCloseToOther = isAlreadyPlaced || isTooCloseToOtherShip(&ship, game);
 
     if(isOnReef) {
-        printError(cmd, "PLACING SHIP ON REEF");
+        printError(cmd, game, "PLACING SHIP ON REEF");
         return 1;
     } else if(isTooCloseToOther) {
-        printError(cmd, "PLACING SHIP TOO CLOSE TO OTHER SHIP");
+        printError(cmd, game, "PLACING SHIP TOO CLOSE TO OTHER SHIP");
         return 1;
     } else if(isAlreadyPlaced) {
-        printError(cmd, "SHIP ALREADY PRESENT");
+        printError(cmd, game, "SHIP ALREADY PRESENT");
         return 1;
     }
 
-    player->ships[cIndex][i].isPlaced = true;
-    player->ships[cIndex][i].direction = D;
+    fleet->flags[shipId] |= SHIP_PLACED;
+    fleet->directions[shipId] = (unsigned char) D;
 
     int bitmaskLen = shipsSizes[cIndex];
     for(int b = 0; b < bitmaskLen; b++) {
-        player->ships[cIndex][i].shots |= ((bitmask[b] == '0' ? 1 : 0) << b);
+        fleet->shots[shipId] |= ((bitmask[b] == '0' ? 1 : 0) << b);
     }
+    addPlacedShipParts(player, shipId);
+    // Sight and hits depend on shots, so ship is added once they are known
+    ship = getFleetShip(fleet, shipId);
+    addShipToBoard(game, playerX == 'A' ? 0 : 1, &ship);
 
     return 0;
 }
 
 int shoot(Command* cmd, Game *game) {
-    if(!game->extendedShips && game->players[getCurrentPlayer(cmd)]->hasShoot) {
-        printError(cmd, "NO DOUBLE SHOOTING!");
+    if(!game->extendedShips && game->players[getCurrentPlayer(cmd)].hasShoot) {
+        printError(cmd, game, "NO DOUBLE SHOOTING!");
         return 1;
     } else if(!areAllShipsPlaced(game->players)) {
-        printError(cmd, "NOT ALL SHIPS PLACED");
+        printError(cmd, game, "NOT ALL SHIPS PLACED");
         return 1;
     }
 
     int y, x;
     if(game->extendedShips) {
-        y = atoi(cmd->commandArgs[2]);
-        x = atoi(cmd->commandArgs[3]);
+        y = cmd->intArgs[2];
+        x = cmd->intArgs[3];
     } else {
-        y = atoi(cmd->commandArgs[0]);
-        x = atoi(cmd->commandArgs[1]);
+        y = cmd->intArgs[0];
+        x = cmd->intArgs[1];
     }
 
     if((x < 0 || x >= game->planeSizeX) || (y < 0 || y >= game->planeSizeY)) {
-        printError(cmd, "FIELD DOES NOT EXIST");
+        printError(cmd, game, "FIELD DOES NOT EXIST");
         return 1;
     }
 
-    /*
-     * 1. Iterate over ship fields
-     * - some method which will return array of ship fields placed
-     * Ship field being:
-     * - x position
-     * - y position
-     * - [0|1] if shot (it needs to be pointer to real ship bitmask part)
-     * 2. If x == x, y == y then change shot to 1
-     *
-     */
-    ShipElementVec* elements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-    initShipElementVec(elements);
-    getAllShipElements(elements, game->players);
+    setBitboardBit(&game->shotsMaps[getCurrentPlayer(cmd)], y, x);
 
-    for(int i = 0; i < elements->length; i++) {
-        int elX = elements->ptr[i].pos.x;
-        int elY = elements->ptr[i].pos.y;
-        int nth = elements->ptr[i].nth;
+    // Board cell index knows which part of which ship (if any) lies on the field
+    const ShipCell* target = getShipCellAt(game, y, x);
+    Fleet* targetFleet = getCellFleet(game, target);
+    if(targetFleet != NULL && !(targetFleet->shots[target->shipId] & (1 << target->nth))) {
+        int targetPlayerIndex = target->playerIndex;
+        int shipId = target->shipId;
 
-        if(x == elX && y == elY) {
-            elements->ptr[i].ship->shots |= (1 << nth);
-            break;
+        // Destroyed radar shrinks the sight of the ship
+        int isRadarHit = target->nth == 0;
+        Ship targetShip = getFleetShip(targetFleet, shipId);
+        if(isRadarHit) revealShipSight(game, targetPlayerIndex, &targetShip, -1);
+        targetFleet->shots[shipId] |= (1 << target->nth);
+        targetShip.shots = (char) targetFleet->shots[shipId];
+        if(isRadarHit) revealShipSight(game, targetPlayerIndex, &targetShip, 1);
+        setBitboardBit(&game->hitsMaps[targetPlayerIndex], y, x);
+
+        game->players[targetPlayerIndex].remainingParts--;
+        if(targetFleet->shots[shipId] == (1 << targetShip.size) - 1) {
+            targetFleet->flags[shipId] |= SHIP_SUNK;
         }
     }
 
-    free(elements->ptr);
-    free(elements);
-
     if(!game->extendedShips) {
-        game->players[getCurrentPlayer(cmd)]->hasShoot = true;
-        game->players[!getCurrentPlayer(cmd)]->hasShoot = false;
+        game->players[getCurrentPlayer(cmd)].hasShoot = true;
+        game->players[!getCurrentPlayer(cmd)].hasShoot = false;
     }
 
     return 0;
@@ -795,47 +1758,28 @@ int setNextPlayer(Command* cmd, Game* game) {
     return 0;
 }
 
-char** alloc2DArray(int y, int x) {
-    char** arr = (char**) malloc(sizeof(char**) * y);
-
-    for(int i = 0; i < y; i++) {
-        arr[i] = (char*) malloc(sizeof(char*) * x);
-    }
-
-    return arr;
-}
-
-void clear2DArray(int y, int x, char** arr, char symbol) {
-    for(int i = 0; i < y; i++) {
-        for(int j = 0; j < x; j++) {
-            arr[i][j] = symbol;
-        }
-    }
-}
-
-void free2DArray(int y, char** arr) {
-    for(int i = 0; i < y; i++)
-        free(arr[i]);
-    free(arr);
+int isInsideBoard(Game* game, int y, int x) {
+    return y >= 0 && y < game->planeSizeY && x >= 0 && x < game->planeSizeX;
 }
 
 int setBoardSize(Command* cmd, Game* game) {
-    int y = atoi(cmd->commandArgs[0]);
-    int x = atoi(cmd->commandArgs[1]);
+    int y = cmd->intArgs[0];
+    int x = cmd->intArgs[1];
     game->planeSizeY = y;
     game->planeSizeX = x;
+    layoutBoardArena(game, game->reefsCapacity);
     return 0;
 }
 
-int setInitPos(Command* cmd, Player** players) {
+int setInitPos(Command* cmd, Game* game) {
     char playerX = cmd->commandArgs[0][0];
     int playerIndex = playerX == 'A' ? 0 : 1;
-    Player* playerToModify = players[playerIndex];
+    Player* playerToModify = &game->players[playerIndex];
     int startX, endX, startY, endY;
-    startY = atoi(cmd->commandArgs[1]);
-    startX = atoi(cmd->commandArgs[2]);
-    endY = atoi(cmd->commandArgs[3]);
-    endX = atoi(cmd->commandArgs[4]);
+    startY = cmd->intArgs[1];
+    startX = cmd->intArgs[2];
+    endY = cmd->intArgs[3];
+    endX = cmd->intArgs[4];
     playerToModify->initArea.start.y = startY;
     playerToModify->initArea.start.x = startX;
     playerToModify->initArea.end.y = endY;
@@ -844,21 +1788,25 @@ int setInitPos(Command* cmd, Player** players) {
 }
 
 int addReef(Command* cmd, Game* game) {
-    int y = atoi(cmd->commandArgs[0]);
-    int x = atoi(cmd->commandArgs[1]);
+    int y = cmd->intArgs[0];
+    int x = cmd->intArgs[1];
 
     int isWellPlaced = (x >= 0 && x <= game->planeSizeX - 1)
             && (y >= 0 && y < game->planeSizeY - 1);
 
     if(!isWellPlaced) {
-        printError(cmd, "REEF IS NOT PLACED ON BOARD");
+        printError(cmd, game, "REEF IS NOT PLACED ON BOARD");
         return 1;
     }
 
     Point reef;
     reef.x = x;
     reef.y = y;
-    pointVecPushBack(game->reefs, reef);
+    if(game->reefsCount == game->reefsCapacity) {
+        layoutBoardArena(game, 2 * game->reefsCapacity);
+    }
+    game->reefs[game->reefsCount++] = reef;
+    markReef(game, reef);
     return 0;
 }
 
@@ -869,7 +1817,8 @@ Rectangle getRectOccupiedBy(Ship ship) {
     int backX = x;
     enum Direction D = ship.direction;
     int shipSize = ship.size;
-    Rectangle rect;
+    // Ship with an unknown direction covers only its head
+    Rectangle rect = {ship.headPos, ship.headPos};
     switch(D) {
         case 'N': {
             backY += shipSize - 1;
@@ -909,20 +1858,27 @@ Rectangle getRectOccupiedBy(Ship ship) {
     return rect;
 }
 
+void markReef(Game* game, Point reef) {
+    if(!isInsideBoard(game, reef.y, reef.x)) return;
+    setBitboardBit(&game->reefsMap, reef.y, reef.x);
+}
+
+void rebuildReefMap(Game* game) {
+    clearBitboard(&game->reefsMap);
+    for(int reefI = 0; reefI < game->reefsCount; reefI++) {
+        markReef(game, game->reefs[reefI]);
+    }
+}
+
 int isPointInsideRect(Rectangle* rect, Point* point) {
     return (point->x >= rect->start.x) && (point->x <= rect->end.x)
     && (point->y >= rect->start.y) && (point->y <= rect->end.y);
 }
 
+// Reefs are only placed on board, so only part of the ship inside it has to be checked
 int isShipOnReef(Ship ship, Game* game) {
-    for(int reefI = 0; reefI < game->reefs->length; reefI++) {
-        Point reef = game->reefs->ptr[reefI];
-        Rectangle rect = getRectOccupiedBy(ship);
-        if(isPointInsideRect(&rect, &reef)) {
-            return 1;
-        }
-    }
-    return 0;
+    Rectangle rect = getRectOccupiedBy(ship);
+    return isAnyBitInRect(&game->reefsMap, rect.start.y, rect.start.x, rect.end.y, rect.end.x);
 }
 
 int isTooCloseToOtherShip(Ship* ship, Game* game) {
@@ -931,20 +1887,19 @@ int isTooCloseToOtherShip(Ship* ship, Game* game) {
     rect.start.y--;
     rect.end.x++;
     rect.end.y++;
-    ShipElementVec* elements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-    initShipElementVec(elements);
-    getAllShipElements(elements, game->players);
-    for(int i = 0; i < elements->length; i++) {
-        Point p = elements->ptr[i].pos;
-        int isPInside = isPointInsideRect(&rect, &p);
-        if(isPInside) {
-            free(elements->ptr);
-            free(elements);
-            return 1;
+
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        Bitboard* shipsMap = &game->shipsMaps[playerI];
+        if(isAnyBitInRect(shipsMap, rect.start.y, rect.start.x, rect.end.y, rect.end.x)) return 1;
+    }
+
+    // Ship maps only know parts lying on board, ships loaded by SHIP command may stick out of it
+    if(game->offBoardParts == 0) return 0;
+    for(int y = rect.start.y; y <= rect.end.y; y++) {
+        for(int x = rect.start.x; x <= rect.end.x; x++) {
+            if(!isInsideBoard(game, y, x) && getOffBoardPartsAt(game, y, x) > 0) return 1;
         }
     }
-    free(elements->ptr);
-    free(elements);
     return 0;
 }
 
@@ -974,6 +1929,348 @@ void getShipDirMods(Ship* ship, int* modY, int* modX) {
     }
 }
 
+// Caller has to make sure that (y, x) is inside the board
+// Carriers can shoot at any field, other ships as far from the cannon as they are long
+int isInCannonRange(Ship* ship, int y, int x) {
+    if(ship->size == shipsSizes[CARRIERS]) return true;
+    int modY, modX;
+    getShipDirMods(ship, &modY, &modX);
+    int cannonY = ship->headPos.y + modY;
+    int cannonX = ship->headPos.x + modX;
+    return (y - cannonY) * (y - cannonY) + (x - cannonX) * (x - cannonX) <= ship->size * ship->size;
+}
+
+// Index of the field within its tile
+int getTileFieldIndex(int y, int x) {
+    return (y % TILE_SIDE) * TILE_SIDE + x % TILE_SIDE;
+}
+
+const ShipCell* getShipCellAt(Game* game, int y, int x) {
+    if(!game->isSparseBoard) return &game->shipCells[(size_t) y * game->planeSizeX + x];
+
+    ShipCell* tile = (ShipCell*) findTile(&game->shipCellTiles, y / TILE_SIDE, x / TILE_SIDE);
+    return tile == NULL ? &emptyShipCell : &tile[getTileFieldIndex(y, x)];
+}
+
+ShipCell* getShipCellToUpdate(Game* game, int y, int x) {
+    if(!game->isSparseBoard) return &game->shipCells[(size_t) y * game->planeSizeX + x];
+
+    ShipCell* tile = (ShipCell*) getOrAddTile(&game->shipCellTiles, y / TILE_SIDE, x / TILE_SIDE);
+    return &tile[getTileFieldIndex(y, x)];
+}
+
+int* getRevealCountToUpdate(Game* game, int playerIndex, int y, int x) {
+    if(!game->isSparseBoard) return &game->revealCounts[playerIndex][(size_t) y * game->planeSizeX + x];
+
+    int* tile = (int*) getOrAddTile(&game->revealCountTiles[playerIndex], y / TILE_SIDE, x / TILE_SIDE);
+    return &tile[getTileFieldIndex(y, x)];
+}
+
+// Grid cell holding the coordinate, rounded down so that negative coordinates get cells of their own
+int getOffBoardGridCell(int coordinate) {
+    if(coordinate >= 0) return coordinate / OFF_BOARD_GRID_SIDE;
+    return -((-(coordinate + 1)) / OFF_BOARD_GRID_SIDE) - 1;
+}
+
+// Returns NULL if the grid cell of the field has no counters and they are not created
+int* getOffBoardPartCount(Game* game, int y, int x, int isCreated) {
+    int cellY = getOffBoardGridCell(y);
+    int cellX = getOffBoardGridCell(x);
+    int* counts = isCreated ? (int*) getOrAddTile(&game->offBoardPartTiles, cellY, cellX)
+                            : (int*) findTile(&game->offBoardPartTiles, cellY, cellX);
+    if(counts == NULL) return NULL;
+    return &counts[(y - cellY * OFF_BOARD_GRID_SIDE) * OFF_BOARD_GRID_SIDE + x - cellX * OFF_BOARD_GRID_SIDE];
+}
+
+int getOffBoardPartsAt(Game* game, int y, int x) {
+    int* count = getOffBoardPartCount(game, y, x, false);
+    return count == NULL ? 0 : *count;
+}
+
+void addOffBoardPart(Game* game, int y, int x, int delta) {
+    *getOffBoardPartCount(game, y, x, true) += delta;
+    game->offBoardParts += delta;
+}
+
+// Writes ship into board cell index (or clears its cells if it is not added)
+void markShipCells(Game* game, Ship* ship, int playerIndex, int isAdded) {
+    int modY, modX;
+    getShipDirMods(ship, &modY, &modX);
+
+    int y = ship->headPos.y;
+    int x = ship->headPos.x;
+    for(int nth = 0; nth < ship->size; nth++) {
+        // Ships loaded by SHIP command does not have to fit the board
+        if(isInsideBoard(game, y, x)) {
+            ShipCell* cell = getShipCellToUpdate(game, y, x);
+            if(isAdded) {
+                cell->shipId = ship->ID;
+                cell->playerIndex = (int8_t) playerIndex;
+                cell->nth = (int8_t) nth;
+                setBitboardBit(&game->shipsMaps[playerIndex], y, x);
+                if(isShotAt(ship, nth)) setBitboardBit(&game->hitsMaps[playerIndex], y, x);
+            } else {
+                *cell = emptyShipCell;
+                clearBitboardBit(&game->shipsMaps[playerIndex], y, x);
+                clearBitboardBit(&game->hitsMaps[playerIndex], y, x);
+            }
+        } else {
+            addOffBoardPart(game, y, x, isAdded ? 1 : -1);
+        }
+        y += modY;
+        x += modX;
+    }
+}
+
+// Adds delta to reveal counters of the player on fields of the rectangle lying on board
+void revealRect(Game* game, int playerIndex, Rectangle rect, int delta) {
+    if(rect.start.y < 0) rect.start.y = 0;
+    if(rect.start.x < 0) rect.start.x = 0;
+    if(rect.end.y > game->planeSizeY - 1) rect.end.y = game->planeSizeY - 1;
+    if(rect.end.x > game->planeSizeX - 1) rect.end.x = game->planeSizeX - 1;
+
+    for(int y = rect.start.y; y <= rect.end.y; y++) {
+        for(int x = rect.start.x; x <= rect.end.x; x++) {
+            addRevealAt(game, playerIndex, y, x, delta);
+        }
+    }
+}
+
+// Visibility map has a bit set wherever the reveal counter is not 0
+void addRevealAt(Game* game, int playerIndex, int y, int x, int delta) {
+    int* count = getRevealCountToUpdate(game, playerIndex, y, x);
+    int wasVisible = *count > 0;
+    *count += delta;
+    if(wasVisible && *count == 0) {
+        clearBitboardBit(&game->visibilityMaps[playerIndex], y, x);
+    } else if(!wasVisible && *count > 0) {
+        setBitboardBit(&game->visibilityMaps[playerIndex], y, x);
+    }
+}
+
+/* Field is visible to a player if its reveal counter is not 0. Every placed ship reveals
+ * its own fields, fields in its radar range (1 if the radar is destroyed) and 3x3 squares
+ * around its spy planes. Counter has to be decreased with the same ship state it was
+ * increased with, so callers remove the ship before changing its position or radar. */
+void revealShipSight(Game* game, int playerIndex, Ship* ship, int delta) {
+    int modY, modX;
+    getShipDirMods(ship, &modY, &modX);
+
+    int y = ship->headPos.y;
+    int x = ship->headPos.x;
+    for(int nth = 0; nth < ship->size; nth++) {
+        if(isInsideBoard(game, y, x)) {
+            addRevealAt(game, playerIndex, y, x, delta);
+        }
+        y += modY;
+        x += modX;
+    }
+
+    int radarRadius = isShotAt(ship, 0) ? 1 : ship->size;
+    int headY = ship->headPos.y;
+    int headX = ship->headPos.x;
+    for(int dy = -radarRadius; dy <= radarRadius; dy++) {
+        for(int dx = -radarRadius; dx <= radarRadius; dx++) {
+            if(dy*dy + dx*dx > radarRadius*radarRadius) continue;
+            if(!isInsideBoard(game, headY + dy, headX + dx)) continue;
+            addRevealAt(game, playerIndex, headY + dy, headX + dx, delta);
+        }
+    }
+
+    for(int spyI = 0; spyI < ship->spyPlanesCount; spyI++) {
+        Point spyPlane = ship->spyPlanes[spyI];
+        Rectangle spyRect = {{spyPlane.x - 1, spyPlane.y - 1}, {spyPlane.x + 1, spyPlane.y + 1}};
+        revealRect(game, playerIndex, spyRect, delta);
+    }
+}
+
+// Keeps board indexes (cell index, ship maps, visibility) in sync with a ship which becomes placed
+void addShipToBoard(Game* game, int playerIndex, Ship* ship) {
+    markShipCells(game, ship, playerIndex, true);
+    revealShipSight(game, playerIndex, ship, 1);
+}
+
+void removeShipFromBoard(Game* game, int playerIndex, Ship* ship) {
+    markShipCells(game, ship, playerIndex, false);
+    revealShipSight(game, playerIndex, ship, -1);
+}
+
+int isSparseBoardSize(int sizeY, int sizeX) {
+    return sizeY > 0 && sizeX > 0 && (int64_t) sizeY * sizeX >= SPARSE_BOARD_MIN_FIELDS;
+}
+
+size_t getBoardArenaSize(Game* game) {
+    size_t reefsSize = (size_t) game->reefsCapacity * sizeof(Point);
+    if(game->isSparseBoard) return reefsSize;
+
+    size_t cellsCount = 0;
+    if(game->planeSizeY > 0 && game->planeSizeX > 0) {
+        cellsCount = (size_t) game->planeSizeY * game->planeSizeX;
+    }
+    size_t wordsCount = getBitboardWordsCount(game->planeSizeY, game->planeSizeX);
+    return BOARD_BITBOARDS_COUNT * wordsCount * sizeof(uint64_t)
+           + cellsCount * (sizeof(ShipCell) + PLAYERS_COUNT * sizeof(int))
+           + reefsSize;
+}
+
+void listBoardBitboards(Game* game, Bitboard** bitboards) {
+    bitboards[0] = &game->reefsMap;
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        bitboards[1 + 4 * playerI] = &game->shipsMaps[playerI];
+        bitboards[2 + 4 * playerI] = &game->hitsMaps[playerI];
+        bitboards[3 + 4 * playerI] = &game->visibilityMaps[playerI];
+        bitboards[4 + 4 * playerI] = &game->shotsMaps[playerI];
+    }
+}
+
+/* Points the game into its board arena, words of bitboards go first as they need the biggest alignment.
+ * Sparse boards keep their tile maps, only reefs are in the arena. */
+void assignBoardArena(Game* game) {
+    int sizeY = game->planeSizeY;
+    int sizeX = game->planeSizeX;
+    char* next = game->boardArena;
+
+    if(game->isSparseBoard) {
+        game->shipCells = NULL;
+        for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+            game->revealCounts[playerI] = NULL;
+        }
+    } else {
+        size_t cellsCount = (sizeY > 0 && sizeX > 0) ? (size_t) sizeY * sizeX : 0;
+        size_t wordsCount = getBitboardWordsCount(sizeY, sizeX);
+        Bitboard* bitboards[BOARD_BITBOARDS_COUNT];
+        listBoardBitboards(game, bitboards);
+        for(int boardI = 0; boardI < BOARD_BITBOARDS_COUNT; boardI++) {
+            attachBitboard(bitboards[boardI], (uint64_t*) next, sizeY, sizeX);
+            next += wordsCount * sizeof(uint64_t);
+        }
+
+        game->shipCells = (ShipCell*) next;
+        next += cellsCount * sizeof(ShipCell);
+        for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+            game->revealCounts[playerI] = (int*) next;
+            next += cellsCount * sizeof(int);
+        }
+    }
+    game->reefs = (Point*) next;
+    next += game->reefsCapacity * sizeof(Point);
+
+    game->boardArenaSize = next - game->boardArena;
+}
+
+// Frees tiles of a sparse board, shots maps are left alone unless asked for
+void freeSparseBoard(Game* game, int withShots) {
+    if(!game->isSparseBoard) return;
+
+    Bitboard* bitboards[BOARD_BITBOARDS_COUNT];
+    listBoardBitboards(game, bitboards);
+    for(int boardI = 0; boardI < BOARD_BITBOARDS_COUNT; boardI++) {
+        int isShotsMap = boardI % 4 == 0 && boardI > 0;
+        if(withShots || !isShotsMap) freeBitboard(bitboards[boardI]);
+    }
+    clearTileMap(&game->shipCellTiles);
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        clearTileMap(&game->revealCountTiles[playerI]);
+    }
+}
+
+/* Arena is laid out again whenever the board size or the reefs capacity changes. Reefs are kept,
+ * so are shots if the board size has not changed, everything else is rebuilt from the ships. */
+void layoutBoardArena(Game* game, int reefsCapacity) {
+    char* oldArena = game->boardArena;
+    Point* oldReefs = game->reefs;
+    int wasSparse = oldArena != NULL && game->isSparseBoard;
+    Bitboard oldShotsMaps[PLAYERS_COUNT];
+    memcpy(oldShotsMaps, game->shotsMaps, sizeof(oldShotsMaps));
+    if(oldArena != NULL) freeSparseBoard(game, false);
+
+    game->isSparseBoard = isSparseBoardSize(game->planeSizeY, game->planeSizeX);
+    game->reefsCapacity = reefsCapacity;
+    size_t arenaSize = getBoardArenaSize(game);
+    game->boardArena = (char*) malloc(arenaSize > 0 ? arenaSize : 1);
+    STATS_ALLOCATION(arenaSize);
+    game->boardArenaCapacity = arenaSize;
+    assignBoardArena(game);
+    if(game->isSparseBoard) {
+        Bitboard* bitboards[BOARD_BITBOARDS_COUNT];
+        listBoardBitboards(game, bitboards);
+        for(int boardI = 0; boardI < BOARD_BITBOARDS_COUNT; boardI++) {
+            initSparseBitboard(bitboards[boardI], game->planeSizeY, game->planeSizeX);
+        }
+        initTileMap(&game->shipCellTiles, TILE_FIELDS * sizeof(ShipCell), -1);
+        for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+            initTileMap(&game->revealCountTiles[playerI], TILE_FIELDS * sizeof(int), 0);
+        }
+    }
+
+    if(game->reefsCount > 0) memcpy(game->reefs, oldReefs, game->reefsCount * sizeof(Point));
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        Bitboard* shotsMap = &game->shotsMaps[playerI];
+        int isSameSize = oldArena != NULL && oldShotsMaps[playerI].sizeY == shotsMap->sizeY
+                         && oldShotsMaps[playerI].sizeX == shotsMap->sizeX;
+        // Mode follows the size, so a kept sparse map just takes over its tiles
+        if(isSameSize && game->isSparseBoard) {
+            *shotsMap = oldShotsMaps[playerI];
+            continue;
+        }
+        if(wasSparse) freeBitboard(&oldShotsMaps[playerI]);
+        if(isSameSize) {
+            memcpy(shotsMap->words, oldShotsMaps[playerI].words, shotsMap->sizeY * shotsMap->stride * sizeof(uint64_t));
+        } else {
+            clearBitboard(shotsMap);
+        }
+    }
+    free(oldArena);
+
+    rebuildReefMap(game);
+    rebuildBoardIndexes(game);
+}
+
+void rebuildBoardIndexes(Game* game) {
+    if(game->isSparseBoard) {
+        clearTileMap(&game->shipCellTiles);
+    } else {
+        size_t cellsCount = 0;
+        if(game->planeSizeY > 0 && game->planeSizeX > 0) {
+            cellsCount = (size_t) game->planeSizeY * game->planeSizeX;
+        }
+        memset(game->shipCells, -1, cellsCount * sizeof(ShipCell));
+        for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+            memset(game->revealCounts[playerI], 0, cellsCount * sizeof(int));
+        }
+    }
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        if(game->isSparseBoard) clearTileMap(&game->revealCountTiles[playerI]);
+        clearBitboard(&game->shipsMaps[playerI]);
+        clearBitboard(&game->hitsMaps[playerI]);
+        clearBitboard(&game->visibilityMaps[playerI]);
+    }
+    game->offBoardParts = 0;
+    clearTileMap(&game->offBoardPartTiles);
+
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        Fleet* fleet = &game->players[playerI].fleet;
+        for(int shipId = 0; shipId < getFleetShipsCount(fleet); shipId++) {
+            if(!(fleet->flags[shipId] & SHIP_PLACED)) continue;
+            Ship ship = getFleetShip(fleet, shipId);
+            addShipToBoard(game, playerI, &ship);
+        }
+    }
+}
+
+// Fleet of the ship lying on the cell, or NULL if the cell is free
+Fleet* getCellFleet(Game* game, const ShipCell* cell) {
+    if(cell->shipId == -1) return NULL;
+    return &game->players[cell->playerIndex].fleet;
+}
+
+int getClassIndexBySize(int size) {
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        if(shipsSizes[classI] == size) return classI;
+    }
+    return CARRIERS;
+}
+
 int isShotAt(Ship* ship, int distFromHead) {
     char shotBitmap = ship->shots;
     return (shotBitmap & (1 << distFromHead));
@@ -1029,28 +2326,33 @@ int moveShip(Command* cmd, Game* game) {
      * 4. the ship not moves out of board (SHIP WENT FROM BOARD) DONE
      * 5. the ship is not placed too close to other ships (PLACING SHIP TOO CLOSE TO OTHER SHIP).
      */
-    int i = atoi(cmd->commandArgs[0]);
+    int i = cmd->intArgs[0];
     int cIndex = getClassIndex(cmd->commandArgs[1]);
     char xDir = cmd->commandArgs[2][0];
-    Player* currentPlayer = game->players[getCurrentPlayer(cmd)];
+    Fleet* fleet = &game->players[getCurrentPlayer(cmd)].fleet;
+    int shipId = getFleetShipId(fleet, cIndex, i);
+    if(shipId == -1) {
+        printError(cmd, game, "SHIP CANNOT MOVE");
+        return 1;
+    }
 
     // We will copy ship from player, try to move it and if validation succeeds then we will copy
     // validationShip x, y and direction to real player ship
-    Ship validationShip = currentPlayer->ships[cIndex][i];
+    Ship validationShip = getFleetShip(fleet, shipId);
 
     // Validation which doesn't require to calculate new position
 
     // Check if engine is right, engine is a part of the ship at its back
     int cannotMove = game->extendedShips && isShotAt(&validationShip, validationShip.size - 1);
     if(cannotMove) {
-        printError(cmd, "SHIP CANNOT MOVE");
+        printError(cmd, game, "SHIP CANNOT MOVE");
         return 1;
     }
 
     int maxMoves = cIndex == CARRIERS ? 2 : 3;
-    int hasShipUsedItsMoves = validationShip.timesMoved == maxMoves;
+    int hasShipUsedItsMoves = fleet->timesMoved[shipId] == maxMoves;
     if(hasShipUsedItsMoves) {
-        printError(cmd, "SHIP MOVED ALREADY");
+        printError(cmd, game, "SHIP MOVED ALREADY");
         return 1;
     }
 
@@ -1089,7 +2391,7 @@ int moveShip(Command* cmd, Game* game) {
     // Rest of validation which should be done after movement calculation
     int isOnReef = isShipOnReef(validationShip, game);
     if(isOnReef) {
-        printError(cmd, "PLACING SHIP ON REEF");
+        printError(cmd, game, "PLACING SHIP ON REEF");
         return 1;
     }
 
@@ -1097,31 +2399,33 @@ int moveShip(Command* cmd, Game* game) {
     int isInsideBoard = (shipRect.start.x >= 0 && shipRect.end.x <= (game->planeSizeX - 1))
             && (shipRect.start.y >= 0 && shipRect.end.y <= (game->planeSizeY - 1));
     if(!isInsideBoard) {
-        printError(cmd, "SHIP WENT FROM BOARD");
+        printError(cmd, game, "SHIP WENT FROM BOARD");
         return 1;
     }
 
-    // Disable isPlaced of ship so placement validation will work correctly
-    currentPlayer->ships[cIndex][i].isPlaced = 0;
+    // Take the ship off the board so placement validation will not see it
+    Ship realShip = getFleetShip(fleet, shipId);
+    removeShipFromBoard(game, getCurrentPlayer(cmd), &realShip);
+    fleet->flags[shipId] &= ~SHIP_PLACED;
 
     int isTooCloseToOthers = isTooCloseToOtherShip(&validationShip, game);
+
+    fleet->flags[shipId] |= SHIP_PLACED;
     if(isTooCloseToOthers) {
-        printError(cmd, "PLACING SHIP TOO CLOSE TO OTHER SHIP");
+        addShipToBoard(game, getCurrentPlayer(cmd), &realShip);
+        printError(cmd, game, "PLACING SHIP TOO CLOSE TO OTHER SHIP");
         return 1;
     }
 
-    // Reenable isPlaced after check
-    currentPlayer->ships[cIndex][i].isPlaced = 1;
-
     // Finally if all validations succeeded change position of real ship
-    currentPlayer->ships[cIndex][i].headPos.x = validationShip.headPos.x;
-    currentPlayer->ships[cIndex][i].headPos.y = validationShip.headPos.y;
+    fleet->heads[shipId] = validationShip.headPos;
 
     // Update moves count
-    currentPlayer->ships[cIndex][i].timesMoved++;
+    fleet->timesMoved[shipId]++;
 
     // Update ship's direction
-    currentPlayer->ships[cIndex][i].direction = validationShip.direction;
+    fleet->directions[shipId] = (unsigned char) validationShip.direction;
+    addShipToBoard(game, getCurrentPlayer(cmd), &validationShip);
 
     return 0;
 }
@@ -1132,92 +2436,118 @@ int shootExtended(Command* cmd, Game* game) {
      * 2. the ship is not shooting too many shoots (TOO MANY SHOOTS),
      * 3. the ship is shooting in the cannons range(SHOOTING TOO FAR).
      */
-    int i = atoi(cmd->commandArgs[0]);
+    int i = cmd->intArgs[0];
     int cIndex = getClassIndex(cmd->commandArgs[1]);
-    int y = atoi(cmd->commandArgs[2]);
-    int x = atoi(cmd->commandArgs[3]);
+    int y = cmd->intArgs[2];
+    int x = cmd->intArgs[3];
 
-    Ship* shootingShip = &game->players[getCurrentPlayer(cmd)]->ships[cIndex][i];
+    Fleet* fleet = &game->players[getCurrentPlayer(cmd)].fleet;
+    int shipId = getFleetShipId(fleet, cIndex, i);
+    if(shipId == -1) {
+        printError(cmd, game, "SHIP CANNOT SHOOT");
+        return 1;
+    }
+    Ship shootingShip = getFleetShip(fleet, shipId);
 
-    int isCannonDestroyed = isShotAt(shootingShip, 1);
+    int isCannonDestroyed = isShotAt(&shootingShip, 1);
     if(isCannonDestroyed) {
-        printError(cmd, "SHIP CANNOT SHOOT");
+        printError(cmd, game, "SHIP CANNOT SHOOT");
         return 1;
     }
 
-    int usedAllShots = shootingShip->shotThisTurn == shootingShip->size;
+    int usedAllShots = fleet->shotsThisTurn[shipId] == shootingShip.size;
     if(usedAllShots) {
-        printError(cmd, "TOO MANY SHOOTS");
+        printError(cmd, game, "TOO MANY SHOOTS");
         return 1;
     }
 
-    int cannonX, cannonY;
-    int modX, modY;
-    getShipDirMods(shootingShip, &modY, &modX);
-    cannonX = shootingShip->headPos.x + modX;
-    cannonY = shootingShip->headPos.y + modY;
-
-    int isNearEnough = cIndex == CARRIERS
-            || (((y - cannonY)*(y - cannonY) + (x - cannonX)*(x - cannonX)) <= (shootingShip->size*shootingShip->size));
-    if(!isNearEnough) {
-        printError(cmd, "SHOOTING TOO FAR");
+    if(!isInCannonRange(&shootingShip, y, x)) {
+        printError(cmd, game, "SHOOTING TOO FAR");
         return 1;
     }
 
     shoot(cmd, game);
-    shootingShip->shotThisTurn++;
+    fleet->shotsThisTurn[shipId]++;
 
     return 0;
 }
 
-void printGameToArr(Command* cmd, Game *game, char** gamePlane) {
-    char type = cmd->commandArgs[0][0];
-    clear2DArray(game->planeSizeY, game->planeSizeX, gamePlane, ' ');
-
-    ShipElementVec* shipElements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-    initShipElementVec(shipElements);
-    getAllShipElements(shipElements, game->players);
-
-    for(int elementIndex = 0; elementIndex < shipElements->length; elementIndex++) {
-        ShipElement* element = &shipElements->ptr[elementIndex];
-        int y = element->pos.y;
-        int x = element->pos.x;
-        int isBroken = shipElements->ptr[elementIndex].ship->shots & (1 << shipElements->ptr[elementIndex].nth);
-
-        char displayChar = '+';
-
-        if(type == '1') {
-            if(element->nth == 0) { // Radar
-                displayChar = '@';
-            } else if(element->nth == element->ship->size-1) { // Engine
-                displayChar = '%';
-            } else if(element->nth == 1) { // Cannon
-                displayChar = '!';
-            }
-        }
+/* Writes row y of the board into row. Reefs cover ships, ships of player B cover ships of player A and
+ * if a viewer is given, everything it cannot see except reefs is covered by fog of war. */
+void renderBoardRow(Game* game, int y, char type, int viewerIndex, char* row) {
+    memset(row, ' ', game->planeSizeX > 0 ? game->planeSizeX : 0);
 
-        if(isBroken) displayChar = 'x';
+    // Only fields with bits set in the maps have to be visited
+    for(int word = 0; word < game->reefsMap.stride; word++) {
+        uint64_t reefs = getBitboardWord(&game->reefsMap, y, word);
+        uint64_t fog = 0;
+        if(viewerIndex != -1) {
+            uint64_t visible = getBitboardWord(&game->visibilityMaps[viewerIndex], y, word);
+            fog = ~(visible | reefs) & getBitboardRangeMask(word, 0, game->planeSizeX - 1);
+        }
 
-        gamePlane[y][x] = displayChar;
+        for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+            uint64_t parts = getBitboardWord(&game->shipsMaps[playerI], y, word) & ~(reefs | fog);
+            if(parts == 0) continue;
+            uint64_t hits = getBitboardWord(&game->hitsMaps[playerI], y, word);
+            while(parts) {
+                int bit = popBitboardLowestBit(&parts);
+                int x = word * BITBOARD_WORD_BITS + bit;
+
+                char displayChar = '+';
+                if((hits >> bit) & 1) {
+                    displayChar = 'x';
+                } else if(type == '1') {
+                    const ShipCell* cell = getShipCellAt(game, y, x);
+                    if(cell->nth == 0) { // Radar
+                        displayChar = '@';
+                    } else if(cell->nth == getCellFleet(game, cell)->sizes[cell->shipId]-1) { // Engine
+                        displayChar = '%';
+                    } else if(cell->nth == 1) { // Cannon
+                        displayChar = '!';
+                    }
+                }
+                row[x] = displayChar;
+            }
+        }
+        while(reefs) {
+            row[word * BITBOARD_WORD_BITS + popBitboardLowestBit(&reefs)] = '#';
+        }
+        while(fog) {
+            row[word * BITBOARD_WORD_BITS + popBitboardLowestBit(&fog)] = '?';
+        }
     }
+}
 
-    free(shipElements->ptr);
-    free(shipElements);
+void initFrameBuffer(FrameBuffer* frame) {
+    frame->data = NULL;
+    frame->length = 0;
+    frame->capacity = 0;
+}
 
-    // Add reefs to plane
-    for(int reefI = 0; reefI < game->reefs->length; reefI++) {
-        Point reef = game->reefs->ptr[reefI];
-        gamePlane[reef.y][reef.x] = '#';
+// Makes sure that size more bytes can be appended without reallocation
+void reserveFrameBuffer(FrameBuffer* frame, size_t size) {
+    if(frame->length + size > frame->capacity) {
+        size_t newCapacity = frame->capacity * 2;
+        if(newCapacity < frame->length + size) newCapacity = frame->length + size;
+        frame->data = (char*) realloc(frame->data, newCapacity);
+        STATS_ALLOCATION(newCapacity);
+        frame->capacity = newCapacity;
     }
 }
 
-void printArr(char** arr, int sizeY, int sizeX) {
-    for(int y = 0; y < sizeY; y++) {
-        for (int x = 0; x < sizeX; x++) {
-            printf("%c", arr[y][x]);
-        }
-        printf("\n");
+void freeFrameBuffer(FrameBuffer* frame) {
+    free(frame->data);
+    initFrameBuffer(frame);
+}
+
+// Writes number with leading zeros, so it takes exactly width characters
+void appendZeroPaddedNumber(FrameBuffer* frame, int number, int width) {
+    for(int digitI = width - 1; digitI >= 0; digitI--) {
+        frame->data[frame->length + digitI] = (char) ('0' + number % 10);
+        number /= 10;
     }
+    frame->length += width;
 }
 
 int getLengthOfNumber(int n) {
@@ -1229,66 +2559,54 @@ int getLengthOfNumber(int n) {
     return length;
 }
 
-int intPow(int a, int n) {
-    if(n == 0) return 1;
-    int res = a;
-    for(int i = 0; i < n; i++) {
-        res *= n;
-    }
-    return res;
-}
+/* Board is rendered row by row straight into the output, so printing does not need memory
+ * for the whole board. Output is flushed on the way once it grows big. Type 1 adds
+ * numbers of rows and columns, viewer is the player seeing the board or -1. */
+void printBoard(Game* game, char type, int viewerIndex) {
+    int sizeY = game->planeSizeY > 0 ? game->planeSizeY : 0;
+    int sizeX = game->planeSizeX > 0 ? game->planeSizeX : 0;
+    FrameBuffer* frame = &game->session->output;
 
-int getIDigitOfNumber(int n, int digitI) {
-    int res = (n/intPow(10, digitI))%10;
-    return res;
-}
+    int heightNumMaxLen = 0;
+    if(type == '1') {
+        int widthNumMaxLen = getLengthOfNumber(sizeX - 1);
+        heightNumMaxLen = getLengthOfNumber(sizeY - 1);
+        reserveFrameBuffer(frame, widthNumMaxLen * (heightNumMaxLen + (size_t) sizeX + 1));
 
-void printArrWithNumbers(char** arr, int sizeY, int sizeX) {
-    int widthNumMaxLen = getLengthOfNumber(sizeX - 1);
-    int heightNumMaxLen = getLengthOfNumber(sizeY - 1);
+        // Column numbers are written vertically, most significant digit in the first line
+        int divisor = 1;
+        for(int lineI = 1; lineI < widthNumMaxLen; lineI++) divisor *= 10;
 
-    for(int lineI = 0; lineI < widthNumMaxLen; lineI++) {
-        for(int h = 0; h < heightNumMaxLen; h++) {
-            printf(" ");
-        }
+        for(int lineI = 0; lineI < widthNumMaxLen; lineI++) {
+            memset(frame->data + frame->length, ' ', heightNumMaxLen);
+            frame->length += heightNumMaxLen;
 
-        for(int x = 0; x < sizeX; x++) {
-            int numLen = getLengthOfNumber(x);
-            int howManyLeading = widthNumMaxLen - numLen;
-            if(howManyLeading-1 >= lineI) {
-                printf("0");
-            } else {
-                printf("%d", getIDigitOfNumber(x, numLen - 1 - lineI + howManyLeading));
+            for(int x = 0; x < sizeX; x++) {
+                frame->data[frame->length++] = (char) ('0' + (x / divisor) % 10);
             }
-        }
+            frame->data[frame->length++] = '\n';
 
-        printf("\n");
+            divisor /= 10;
+        }
     }
 
-    for(int lineI = 0; lineI < sizeY; lineI++) {
-        printf( "%0*d", heightNumMaxLen, lineI);
-        for(int x = 0; x < sizeX; x++) {
-            printf("%c", arr[lineI][x]);
-        }
-        printf("\n");
+    for(int y = 0; y < sizeY; y++) {
+        reserveFrameBuffer(frame, heightNumMaxLen + (size_t) sizeX + 1);
+        if(type == '1') appendZeroPaddedNumber(frame, y, heightNumMaxLen);
+        renderBoardRow(game, y, type, viewerIndex, frame->data + frame->length);
+        frame->length += sizeX;
+        frame->data[frame->length++] = '\n';
+        if(frame->length > PRINT_FLUSH_THRESHOLD) flushGameOutput(game);
     }
-//    printf( "%0*d", 3, i);
 }
 
 int statePrint(Command* cmd, Game *game) {
     char type = cmd->commandArgs[0][0];
-    char** gamePlane = alloc2DArray(game->planeSizeY, game->planeSizeX);
-    printGameToArr(cmd, game, gamePlane);
+    if(type == '0' || type == '1') printBoard(game, type, -1);
 
-    if(type == '0') {
-        printArr(gamePlane, game->planeSizeY, game->planeSizeX);
-    } else if(type == '1') {
-        printArrWithNumbers(gamePlane, game->planeSizeY, game->planeSizeX);
-    }
-
-    printf("PARTS REMAINING:: A : %d B : %d\n",
-           getPlayerRemainingCount(game->players[0]),
-           getPlayerRemainingCount(game->players[1]));
+    gamePrintf(game, "PARTS REMAINING:: A : %d B : %d\n",
+           getPlayerRemainingCount(&game->players[0]),
+           getPlayerRemainingCount(&game->players[1]));
     return 0;
 }
 
@@ -1299,150 +2617,35 @@ Point pointOf(int y, int x) {
     return newP;
 }
 
-int arePointsInRange(Point a, Point b, int range) {
-    return ((a.x - b.x)*(a.x - b.x)) + ((a.y - b.y)*(a.y - b.y)) <= range*range;
-}
-
-int canShipSee(Ship s, Point p) {
-    int radarX = s.headPos.x;
-    int radarY = s.headPos.y;
-    if(arePointsInRange(pointOf(radarY, radarX), p, s.size)) {
-        return true;
-    }
-    return false;
-}
-
-int canPlayerSee(int playerIndex, Point p, Game* game) {
-    Player* player = game->players[playerIndex];
-    for(int classI = 0; classI < TYPES_COUNT; classI++) {
-        for(int shipI = 0; shipI < player->typesCounts[classI]; shipI++) {
-            Ship s = player->ships[classI][shipI];
-            if(canShipSee(s, p)) return true;
-        }
-    }
-    return false;
-}
-
-void playerPrintToArr(Command* cmd, Game* game, char** gamePlane) {
-    printGameToArr(cmd, game, gamePlane);
-
-    char** fogOfWar = alloc2DArray(game->planeSizeY, game->planeSizeX);
-    clear2DArray(game->planeSizeY, game->planeSizeX, fogOfWar, '?');
-
-    // PRINT ALL PRINTING PLAYER'S SHIPS TO PLANE
-    // CREATE ARRAY FULL OF FOG SYMBOLS
-    // ITERATE OVER PRINTING PLAYERS SHIPS and clear some of the fog of war based on radars radiuses
-    ShipElementVec* elements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-    initShipElementVec(elements);
-    Player* currentPlayer = game->players[getCurrentPlayer(cmd)];
-    getShipElementsOfPlayer(currentPlayer, elements);
-
-    for(int i = 0; i < elements->length; i++) {
-        int elX = elements->ptr[i].pos.x;
-        int elY = elements->ptr[i].pos.y;
-        fogOfWar[elY][elX] = ' ';
-    }
-
-    free(elements->ptr);
-    free(elements);
-
-    for(int classI = 0; classI < TYPES_COUNT; classI++) {
-        for(int shipI = 0; shipI < currentPlayer->typesCounts[classI]; shipI++) {
-            if(!currentPlayer->ships[classI][shipI].isPlaced) continue;
-            int headX = currentPlayer->ships[classI][shipI].headPos.x;
-            int headY = currentPlayer->ships[classI][shipI].headPos.y;
-            for(int y = 0; y < game->planeSizeY; y++) {
-                for(int x = 0; x < game->planeSizeX; x++) {
-                    Ship* currentShip = &currentPlayer->ships[classI][shipI];
-
-                    int radarRange;
-
-                    if(isShotAt(currentShip, 0)) {
-                        radarRange = 1;
-                    } else {
-                        radarRange = (currentShip->size)*(currentShip->size);
-                    }
-
-                    int isInRadarRange = (((headX - x)*(headX - x)) + ((headY - y)*(headY - y)))
-                                         <= radarRange;
-                    if(isInRadarRange) {
-                        fogOfWar[y][x] = ' ';
-                    }
-
-                    for(int spyI = 0; spyI < currentShip->spyPlanes.length; spyI++) {
-                        Point* spyPlane = &currentShip->spyPlanes.ptr[spyI];
-                        int startX = spyPlane->x - 1;
-                        int startY = spyPlane-> y - 1;
-                        int endX = spyPlane->x + 1;
-                        int endY = spyPlane->y + 1;
-
-                        int isInSpyPlaneRange = (x >= startX) && (x <= endX) && (y >= startY) && (y <= endY);
-
-                        if(isInSpyPlaneRange) {
-                            fogOfWar[y][x] = ' ';
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    for(int y = 0; y < game->planeSizeY; y++) {
-        for(int x = 0; x < game->planeSizeX; x++) {
-            if(fogOfWar[y][x] == '?' && gamePlane[y][x] != '#') {
-                gamePlane[y][x] = '?';
-            }
-        }
-    }
-
-    free2DArray(game->planeSizeY, fogOfWar);
-}
-
 int playerPrint(Command* cmd, Game* game) {
     char type = cmd->commandArgs[0][0];
-    char** gamePlane = alloc2DArray(game->planeSizeY, game->planeSizeX);
-    playerPrintToArr(cmd, game, gamePlane);
-    if(type == '0') {
-        printArr(gamePlane, game->planeSizeY, game->planeSizeX);
-    } else if(type == '1') {
-        printArrWithNumbers(gamePlane, game->planeSizeY, game->planeSizeX);
-    }
-    free2DArray(game->planeSizeY, gamePlane);
+    if(type == '0' || type == '1') printBoard(game, type, getCurrentPlayer(cmd));
     return 0;
 }
 
-void freeAllSpyPlanes(Game* game) {
-    for(int playerI = 0; playerI < 2; playerI++) {
-        for(int classI = 0; classI < TYPES_COUNT; classI++) {
-            for(int shipI = 0; shipI < game->players[playerI]->typesCounts[classI]; shipI++) {
-                free(game->players[playerI]->ships[classI][shipI].spyPlanes.ptr);
-            }
-        }
-    }
-}
-
 int placeSpy(Command* cmd, Game* game) {
-    int i = atoi(cmd->commandArgs[0]);
-    int y = atoi(cmd->commandArgs[1]);
-    int x = atoi(cmd->commandArgs[2]);
+    int i = cmd->intArgs[0];
+    int y = cmd->intArgs[1];
+    int x = cmd->intArgs[2];
 
-    Player* currentPlayer = game->players[getCurrentPlayer(cmd)];
-    Ship* carrier = &currentPlayer->ships[CARRIERS][i];
+    Fleet* fleet = &game->players[getCurrentPlayer(cmd)].fleet;
+    int carrierId = getFleetShipId(fleet, CARRIERS, i);
 
-    int isCarrierPlaced = carrier->isPlaced;
+    int isCarrierPlaced = carrierId != -1 && (fleet->flags[carrierId] & SHIP_PLACED);
     if(!isCarrierPlaced) {
-        printError(cmd, "CARRIER IS NOT PLACED");
+        printError(cmd, game, "CARRIER IS NOT PLACED");
         return 1;
     }
 
-    int isCannonDestroyed = isShotAt(carrier, 1);
+    Ship carrier = getFleetShip(fleet, carrierId);
+    int isCannonDestroyed = isShotAt(&carrier, 1);
     if(isCannonDestroyed) {
-        printError(cmd, "CANNOT SEND PLANE");
+        printError(cmd, game, "CANNOT SEND PLANE");
         return 1;
     }
 
-    if(carrier->spyPlanes.length == shipsSizes[CARRIERS]) {
-        printError(cmd, "ALL PLANES SENT");
+    if(carrier.spyPlanesCount == MAX_SPY_PLANES) {
+        printError(cmd, game, "ALL PLANES SENT");
         return 1;
     }
 
@@ -1450,8 +2653,11 @@ int placeSpy(Command* cmd, Game* game) {
     p.x = x;
     p.y = y;
 
-    pointVecPushBack(&carrier->spyPlanes, p);
-    carrier->shotThisTurn++;
+    fleet->spyPlanes[carrierId * MAX_SPY_PLANES + fleet->spyPlanesCounts[carrierId]++] = p;
+    fleet->shotsThisTurn[carrierId]++;
+
+    Rectangle spyRect = {{x - 1, y - 1}, {x + 1, y + 1}};
+    revealRect(game, getCurrentPlayer(cmd), spyRect, 1);
 
     return 0;
 }
@@ -1490,13 +2696,14 @@ void getBitmaskStringFromChar(char* str, char bitmask, int size) {
 }
 
 int saveGame(Game* game) {
-    printf("[state]\n");
+    STATS_START(start);
+    gamePrintf(game, "[state]\n");
 
     // Information about board size
-    printf("BOARD_SIZE %d %d\n", game->planeSizeY, game->planeSizeX);
+    gamePrintf(game, "BOARD_SIZE %d %d\n", game->planeSizeY, game->planeSizeX);
 
     // Information about next player
-    Player* nowPlayer = game->players[(!game->nextPlayerIndex)];
+    Player* nowPlayer = &game->players[(!game->nextPlayerIndex)];
 
     char nextPlayerChar;
     if(nowPlayer->isAI) {
@@ -1505,14 +2712,14 @@ int saveGame(Game* game) {
         nextPlayerChar = getCharOfPlayerIndex(game->nextPlayerIndex);
     }
 
-    printf("NEXT_PLAYER %c\n", nextPlayerChar);
+    gamePrintf(game, "NEXT_PLAYER %c\n", nextPlayerChar);
 
     // Information about players
     for(int playerI = 0; playerI <= 1; playerI++) {
-        Player* currentPlayer = game->players[playerI];
+        Player* currentPlayer = &game->players[playerI];
         char playerChar = getCharOfPlayerIndex(playerI);
 
-        printf("INIT_POSITION %c %d %d %d %d\n",
+        gamePrintf(game, "INIT_POSITION %c %d %d %d %d\n",
                playerChar,
                currentPlayer->initArea.start.y,
                currentPlayer->initArea.start.x,
@@ -1520,7 +2727,7 @@ int saveGame(Game* game) {
                currentPlayer->initArea.end.x
         );
 
-        printf("SET_FLEET %c %d %d %d %d\n",
+        gamePrintf(game, "SET_FLEET %c %d %d %d %d\n",
                playerChar,
                currentPlayer->typesCounts[CARRIERS],
                currentPlayer->typesCounts[BATTLESHIPS],
@@ -1530,15 +2737,16 @@ int saveGame(Game* game) {
 
         for(int classI = 0; classI < TYPES_COUNT; classI++) {
             for(int shipI = 0; shipI < currentPlayer->typesCounts[classI]; shipI++) {
-                Ship* currentShip = &currentPlayer->ships[classI][shipI];
-                if(!currentShip->isPlaced) continue;
+                int shipId = currentPlayer->fleet.classStarts[classI] + shipI;
+                if(!(currentPlayer->fleet.flags[shipId] & SHIP_PLACED)) continue;
+                Ship currentShip = getFleetShip(&currentPlayer->fleet, shipId);
                 char bitmaskStr[8];
-                getBitmaskStringFromChar(bitmaskStr, currentShip->shots, currentShip->size);
-                printf("SHIP %c %d %d %c %d %s %s\n",
+                getBitmaskStringFromChar(bitmaskStr, currentShip.shots, currentShip.size);
+                gamePrintf(game, "SHIP %c %d %d %c %d %s %s\n",
                     playerChar,
-                    currentShip->headPos.y,
-                    currentShip->headPos.x,
-                    currentShip->direction,
+                    currentShip.headPos.y,
+                    currentShip.headPos.x,
+                    currentShip.direction,
                     shipI,
                     getClassNameFromIndex(classI),
                     bitmaskStr
@@ -1547,42 +2755,108 @@ int saveGame(Game* game) {
         }
     }
 
-    for(int reefI = 0; reefI < game->reefs->length; reefI++) {
-        Point reef = game->reefs->ptr[reefI];
-        printf("REEF %d %d\n", reef.y, reef.x);
+    for(int reefI = 0; reefI < game->reefsCount; reefI++) {
+        Point reef = game->reefs[reefI];
+        gamePrintf(game, "REEF %d %d\n", reef.y, reef.x);
     }
 
     if(game->extendedShips) {
-        printf("EXTENDED_SHIPS\n");
+        gamePrintf(game, "EXTENDED_SHIPS\n");
     }
 
     for(int playerI = 0; playerI < 2; playerI++) {
-        if(game->players[playerI]->isAI) {
-            printf("SET_AI_PLAYER %c\n", getCharOfPlayerIndex(playerI));
+        if(game->players[playerI].isAI) {
+            gamePrintf(game, "SET_AI_PLAYER %c\n", getCharOfPlayerIndex(playerI));
         }
     }
 
-    // Information about seed increased by 1
+    /* Information about seed increased by 1, and the random state jumped ahead, so the game
+     * continued from this save draws numbers other than the ones drawn after the save. Seed is
+     * printed only if it was given, a state given by RANDOM_STATE has no seed. */
     if(game->wasSeedGiven) {
-        printf("SRAND %u\n", game->randomSeed+1);
+        gamePrintf(game, "SRAND %u\n", game->randomSeed+1);
+    }
+    if(game->wasSeedGiven || game->wasStateGiven) {
+        PrngState nextState = game->randomState;
+        jumpPrng(&nextState);
+        gamePrintf(game, "RANDOM_STATE");
+        for(int wordI = 0; wordI < PRNG_STATE_WORDS; wordI++) {
+            gamePrintf(game, " %016llx", (unsigned long long) nextState.words[wordI]);
+        }
+        gamePrintf(game, "\n");
     }
 
-    printf("[state]\n");
+    gamePrintf(game, "[state]\n");
+    STATS_STOP(STATS_SAVE_GAME, start, 0);
     return 0;
 }
 
 int setAIPlayer(Command* cmd, Game* game) {
     char playerChar = cmd->commandArgs[0][0];
     int playerIndex = getIndexOfPlayerChar(playerChar);
-    Player* toSet = game->players[playerIndex];
+    Player* toSet = &game->players[playerIndex];
     toSet->isAI = 1;
     return 0;
 }
 
 int setSrand(Command* cmd, Game* game) {
-    int x = atoi(cmd->commandArgs[0]);
+    int x = cmd->intArgs[0];
     game->randomSeed = x;
     game->wasSeedGiven = true;
+    seedGameRandom(game, x);
+    return 0;
+}
+
+int setRandomState(Command* cmd, Game* game) {
+    PrngState state;
+    for(int wordI = 0; wordI < PRNG_STATE_WORDS; wordI++) {
+        char* end;
+        state.words[wordI] = strtoull(cmd->commandArgs[wordI], &end, 16);
+        if(cmd->commandArgs[wordI][0] == '\0' || *end != '\0') {
+            printError(cmd, game, "WRONG RANDOM STATE");
+            return 1;
+        }
+    }
+    if(!isPrngStateValid(&state)) {
+        printError(cmd, game, "WRONG RANDOM STATE");
+        return 1;
+    }
+
+    game->randomState = state;
+    game->wasStateGiven = true;
+    return 0;
+}
+
+int saveBinaryCommand(Command* cmd, Game* game) {
+    FrameBuffer snapshot;
+    initFrameBuffer(&snapshot);
+    writeSnapshot(game, &snapshot);
+    int result = writeSnapshotFile(cmd->commandArgs[0], snapshot.data, snapshot.length);
+    freeFrameBuffer(&snapshot);
+
+    if(result != 0) {
+        printError(cmd, game, "CANNOT SAVE SNAPSHOT");
+        return 1;
+    }
+    return 0;
+}
+
+int loadBinaryCommand(Command* cmd, Game* game) {
+    size_t size;
+    const char* snapshot = mapSnapshotFile(cmd->commandArgs[0], &size);
+    if(snapshot == NULL) {
+        printError(cmd, game, "CANNOT LOAD SNAPSHOT");
+        return 1;
+    }
+
+    int isValid = isSnapshotValid(snapshot, size);
+    if(isValid) loadSnapshot(game, snapshot);
+    unmapSnapshotFile(snapshot, size);
+
+    if(!isValid) {
+        printError(cmd, game, "INVALID SNAPSHOT");
+        return 1;
+    }
     return 0;
 }
 
@@ -1599,67 +2873,55 @@ int isShipRightPlaced(Game* game, Player* player, Ship* ship) {
     return wellPlaced && (!isOnReef) && (!isTooCloseToOther);
 }
 
-void getAllUnplacedShips(Player* player, ShipVec* dest) {
-    for(int classI = 0; classI < TYPES_COUNT; classI++) {
-        for(int shipI = 0; shipI < player->typesCounts[classI]; shipI++) {
-            Ship* ship = &player->ships[classI][shipI];
-            if(!ship->isPlaced) {
-                shipVecPushBack(dest, ship);
-            }
-        }
-    }
-}
-
-void copyShip(Ship* dest, Ship* source) {
-    dest->headPos = source->headPos;
-    dest->size = source->size;
-    dest->isPlaced = source->isPlaced;
-    dest->direction = source->direction;
-    dest->shots = source->shots;
-    dest->shotThisTurn = source->shotThisTurn;
-    dest->timesMoved = source->timesMoved;
-    initPointVec(&dest->spyPlanes);
-    for(int spyI = 0; spyI < source->spyPlanes.length; spyI++) {
-        pointVecPushBack(&dest->spyPlanes, source->spyPlanes.ptr[spyI]);
+/* Clone shares the session of the source. Arena of dest is reused if it is big enough, so dest
+ * has to be zeroed or a clone itself */
+void cloneGame(Game* dest, Game* source) {
+    char* arena = dest->boardArena;
+    size_t arenaCapacity = dest->boardArenaCapacity;
+    if(arena == NULL || arenaCapacity < source->boardArenaSize) {
+        free(arena);
+        arenaCapacity = source->boardArenaSize;
+        arena = (char*) malloc(arenaCapacity > 0 ? arenaCapacity : 1);
+        STATS_ALLOCATION(arenaCapacity);
     }
-    dest->ID = source->ID;
-}
 
-void copyPlayer(Player* dest, Player* source) {
-    dest->initArea = source->initArea;
-    dest->isAI = source->isAI;
-    dest->hasShoot = source->hasShoot;
-    updateTypesCounts(dest, source->typesCounts);
-    for(int classI = 0; classI < TYPES_COUNT; classI++) {
-        for(int shipI = 0; shipI < source->typesCounts[classI]; shipI++) {
-            copyShip(&dest->ships[classI][shipI], &source->ships[classI][shipI]);
+    freeSparseBoard(dest, true);
+    clearTileMap(&dest->offBoardPartTiles);
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        freeFleet(&dest->players[playerI].fleet);
+    }
+    memcpy(dest, source, sizeof(Game));
+    memcpy(arena, source->boardArena, source->boardArenaSize);
+    dest->boardArena = arena;
+    dest->boardArenaCapacity = arenaCapacity;
+    assignBoardArena(dest);
+    copyTileMap(&dest->offBoardPartTiles, &source->offBoardPartTiles);
+    for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+        copyFleet(&dest->players[playerI].fleet, &source->players[playerI].fleet);
+    }
+    if(source->isSparseBoard) {
+        Bitboard* destBitboards[BOARD_BITBOARDS_COUNT];
+        Bitboard* sourceBitboards[BOARD_BITBOARDS_COUNT];
+        listBoardBitboards(dest, destBitboards);
+        listBoardBitboards(source, sourceBitboards);
+        for(int boardI = 0; boardI < BOARD_BITBOARDS_COUNT; boardI++) {
+            copySparseBitboard(destBitboards[boardI], sourceBitboards[boardI]);
+        }
+        copyTileMap(&dest->shipCellTiles, &source->shipCellTiles);
+        for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
+            copyTileMap(&dest->revealCountTiles[playerI], &source->revealCountTiles[playerI]);
         }
     }
 }
 
-// Copies only key aspects of game
-void copyGame(Game* dest, Game* source) {
-    dest->planeSizeX = source->planeSizeX;
-    dest->planeSizeY = source->planeSizeY;
-    dest->nextPlayerIndex = source->nextPlayerIndex;
-    dest->extendedShips = source->extendedShips;
-    dest->shouldEnd = source->shouldEnd;
-    dest->isInsideGroup = source->isInsideGroup;
-    dest->randomSeed = source->randomSeed;
-    memcpy(dest->groupName, source->groupName, strlen(source->groupName) * sizeof(char));
-
-    dest->players = (Player**) malloc(PLAYERS_COUNT * sizeof(Player*));
+void freeGameClone(Game* clone) {
     for(int playerI = 0; playerI < PLAYERS_COUNT; playerI++) {
-        dest->players[playerI] = (Player*) malloc(sizeof(Player));
-        copyPlayer(dest->players[playerI], source->players[playerI]);
+        freeFleet(&clone->players[playerI].fleet);
     }
-
-    PointVec* newReefs = malloc(sizeof(PointVec));
-    initPointVec(newReefs);
-    for(int reefI = 0; reefI < source->reefs->length; reefI++) {
-        pointVecPushBack(newReefs, source->reefs->ptr[reefI]);
-    }
-    dest->reefs = newReefs;
+    freeSparseBoard(clone, true);
+    clearTileMap(&clone->offBoardPartTiles);
+    free(clone->boardArena);
+    free(clone);
 }
 
 char* getClassNameBySize(int size) {
@@ -1678,257 +2940,698 @@ char* getClassNameBySize(int size) {
     return "";
 }
 
-void aiPlaceShips(Player* aiPlayerCp, Game* copyOfGame) {
-    // Randomly choose: Direction and one of unplaced Ships
-    // Randomly choose x, y of ship
-    // Validate x, y
-    // If validation failed then go back to choosing x and y
-    ShipVec* allUnplacedShips = (ShipVec*) malloc(sizeof(ShipVec));
-    initShipVec(allUnplacedShips);
-    getAllUnplacedShips(aiPlayerCp, allUnplacedShips);
-
-    while(allUnplacedShips->length != 0) {
-        int randShipI = rand() % allUnplacedShips->length;
-        Ship* shipToPlace = allUnplacedShips->ptr[randShipI];
-        enum Direction D = directions[rand() % TYPES_COUNT];
-
-        int x, y;
-        do {
-            x = (rand() % (aiPlayerCp->initArea.end.x - aiPlayerCp->initArea.start.x))
-                + aiPlayerCp->initArea.start.x;
-            y = (rand() % (aiPlayerCp->initArea.end.y - aiPlayerCp->initArea.start.y))
-                + aiPlayerCp->initArea.start.y;
-            shipToPlace->headPos.x = x;
-            shipToPlace->headPos.y = y;
-
-            randShipI = rand() % allUnplacedShips->length;
-            D = directions[rand() % TYPES_COUNT];
-            shipToPlace->direction = D;
-
-        } while(!isShipRightPlaced(copyOfGame, aiPlayerCp, shipToPlace));
-
-        shipToPlace->isPlaced = true;
-
-        printf("PLACE_SHIP %d %d %c %d %s\n",
-               y,
-               x,
-               D,
-               shipToPlace->ID,
-               getClassNameBySize(shipToPlace->size)
-        );
+/* Candidates are all heads and directions of ships of the class which fit the initial position area
+ * and are right placed with regard to reefs and ships already on board. Classes with all ships placed
+ * get no candidates and no slots. */
+void initPlacementGenerator(PlacementGenerator* generator, Game* game, Player* player) {
+    Arena* scratch = &game->session->scratch;
+    generator->game = game;
+    generator->area = player->initArea;
+    generator->areaSizeY = player->initArea.end.y - player->initArea.start.y + 1;
+    generator->areaSizeX = player->initArea.end.x - player->initArea.start.x + 1;
+    if(generator->areaSizeY < 0) generator->areaSizeY = 0;
+    if(generator->areaSizeX < 0) generator->areaSizeX = 0;
+    int slotsCount = generator->areaSizeY * generator->areaSizeX * DIRECTIONS_COUNT;
+
+    Fleet* fleet = &player->fleet;
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        PlacementSet* set = &generator->sets[classI];
+        set->candidates = NULL;
+        set->slots = NULL;
+        set->count = 0;
+
+        int isAnyUnplaced = false;
+        for(int shipId = fleet->classStarts[classI]; shipId < fleet->classStarts[classI + 1]; shipId++) {
+            if(!(fleet->flags[shipId] & SHIP_PLACED)) isAnyUnplaced = true;
+        }
+        if(!isAnyUnplaced) continue;
+
+        set->candidates = (PlacementCandidate*) arenaAlloc(scratch, slotsCount * sizeof(PlacementCandidate));
+        set->slots = (int*) arenaAlloc(scratch, slotsCount * sizeof(int));
+
+        for(int slot = 0; slot < slotsCount; slot++) {
+            PlacementCandidate candidate = getPlacementOfSlot(generator, slot);
+            Ship ship = createNewShip(shipsSizes[classI], 0);
+            ship.headPos = candidate.head;
+            ship.direction = candidate.direction;
 
-        free(allUnplacedShips->ptr);
-        initShipVec(allUnplacedShips);
-        getAllUnplacedShips(aiPlayerCp, allUnplacedShips);
+            set->slots[slot] = -1;
+            if(isShipRightPlaced(game, player, &ship)) {
+                set->slots[slot] = set->count;
+                set->candidates[set->count++] = candidate;
+            }
+        }
+    }
+
+    // Every candidate is removed at most once before the sets are restored
+    int candidatesCount = 0;
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        candidatesCount += generator->sets[classI].count;
+    }
+    generator->removed = (RemovedPlacement*) arenaAlloc(scratch, candidatesCount * sizeof(RemovedPlacement));
+    generator->removedCount = 0;
+}
+
+int getPlacementSlot(PlacementGenerator* generator, Point head, int directionI) {
+    if(!isPointInsideRect(&generator->area, &head)) return -1;
+    int cell = (head.y - generator->area.start.y) * generator->areaSizeX + head.x - generator->area.start.x;
+    return cell * DIRECTIONS_COUNT + directionI;
+}
+
+PlacementCandidate getPlacementOfSlot(PlacementGenerator* generator, int slot) {
+    int cell = slot / DIRECTIONS_COUNT;
+    PlacementCandidate candidate;
+    candidate.head = pointOf(generator->area.start.y + cell / generator->areaSizeX,
+                             generator->area.start.x + cell % generator->areaSizeX);
+    candidate.direction = directions[slot % DIRECTIONS_COUNT];
+    return candidate;
+}
+
+// Last candidate takes the place of the removed one, so the set stays dense
+void removePlacementCandidate(PlacementGenerator* generator, PlacementSet* set, int slot) {
+    int index = set->slots[slot];
+    if(index == -1) return;
+    PlacementCandidate last = set->candidates[--set->count];
+    set->candidates[index] = last;
+    set->slots[getPlacementSlot(generator, last.head, getDirectionIndex(last.direction))] = index;
+    set->slots[slot] = -1;
+
+    RemovedPlacement* removed = &generator->removed[generator->removedCount++];
+    removed->classIndex = (int) (set - generator->sets);
+    removed->slot = slot;
+    removed->index = index;
+}
+
+// Removals are undone in reverse order, the candidate moved in place of a removed one goes back to the end
+void restorePlacementCandidates(PlacementGenerator* generator, int removedCount) {
+    while(generator->removedCount > removedCount) {
+        RemovedPlacement* removed = &generator->removed[--generator->removedCount];
+        PlacementSet* set = &generator->sets[removed->classIndex];
+        PlacementCandidate moved = set->candidates[removed->index];
+        set->candidates[set->count] = moved;
+        set->slots[getPlacementSlot(generator, moved.head, getDirectionIndex(moved.direction))] = set->count;
+        set->candidates[removed->index] = getPlacementOfSlot(generator, removed->slot);
+        set->slots[removed->slot] = removed->index;
+        set->count++;
+    }
+}
+
+// Placed ship rules out every candidate which would cover a field of it or next to it
+void excludePlacementsAround(PlacementGenerator* generator, Ship* placed) {
+    Rectangle zone = getRectOccupiedBy(*placed);
+    for(int y = zone.start.y - 1; y <= zone.end.y + 1; y++) {
+        for(int x = zone.start.x - 1; x <= zone.end.x + 1; x++) {
+            for(int classI = 0; classI < TYPES_COUNT; classI++) {
+                PlacementSet* set = &generator->sets[classI];
+                if(set->slots == NULL) continue;
+                for(int directionI = 0; directionI < DIRECTIONS_COUNT; directionI++) {
+                    Ship ship = createNewShip(shipsSizes[classI], 0);
+                    ship.direction = directions[directionI];
+                    int modY, modX;
+                    getShipDirMods(&ship, &modY, &modX);
+                    for(int partI = 0; partI < ship.size; partI++) {
+                        int slot = getPlacementSlot(generator, pointOf(y - partI * modY, x - partI * modX), directionI);
+                        if(slot != -1) removePlacementCandidate(generator, set, slot);
+                    }
+                }
+            }
+        }
     }
+}
 
-    free(allUnplacedShips->ptr);
-    free(allUnplacedShips);
+int getDirectionIndex(enum Direction direction) {
+    for(int directionI = 0; directionI < DIRECTIONS_COUNT; directionI++) {
+        if(directions[directionI] == direction) return directionI;
+    }
+    return 0;
 }
 
-void getEnemyElementsToShoot(int enemyIndex, Ship s, Game* game, ShipElementVec* elements) {
-    ShipElementVec* shipElements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-    initShipElementVec(shipElements);
+/* Ship grown by one field to the right and down is a rectangle of the area grown the same way, and
+ * ships are right placed exactly if their grown rectangles do not overlap. Packer searches for such
+ * rectangles of all unplaced ships among the candidates of the generator. */
+void initFleetPacker(FleetPacker* packer, PlacementGenerator* generator, Player* player) {
+    Game* game = generator->game;
+    Arena* scratch = &game->session->scratch;
+    int grownSizeY = generator->areaSizeY + 1;
+    int grownSizeX = generator->areaSizeX + 1;
+    size_t wordsCount = getBitboardWordsCount(grownSizeY, grownSizeX);
+    uint64_t* words = (uint64_t*) arenaAlloc(scratch, (1 + 2 * TYPES_COUNT) * wordsCount * sizeof(uint64_t));
+    memset(words, 0, (1 + 2 * TYPES_COUNT) * wordsCount * sizeof(uint64_t));
+
+    packer->generator = generator;
+    packer->shipsCount = 0;
+    packer->nodesCount = 0;
+    attachBitboard(&packer->decided, words, grownSizeY, grownSizeX);
+    int neededFields = 0;
+    Fleet* fleet = &player->fleet;
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        packer->shipsLeft[classI] = 0;
+        for(int shipId = fleet->classStarts[classI]; shipId < fleet->classStarts[classI + 1]; shipId++) {
+            if(!(fleet->flags[shipId] & SHIP_PLACED)) packer->shipsLeft[classI]++;
+        }
+        packer->shipsCount += packer->shipsLeft[classI];
+        neededFields += packer->shipsLeft[classI] * (shipsSizes[classI] + 1) * 2;
+
+        for(int isVertical = 0; isVertical < 2; isVertical++) {
+            words += wordsCount;
+            attachBitboard(&packer->starts[classI][isVertical], words, grownSizeY, grownSizeX);
+        }
+        PlacementSet* set = &generator->sets[classI];
+        for(int candidateI = 0; candidateI < set->count; candidateI++) {
+            PlacementCandidate* candidate = &set->candidates[candidateI];
+            int isVertical = candidate->direction == N || candidate->direction == S;
+            Point start = pointOf(candidate->head.y - generator->area.start.y, candidate->head.x - generator->area.start.x);
+            if(candidate->direction == S) start.y -= shipsSizes[classI] - 1;
+            if(candidate->direction == E) start.x -= shipsSizes[classI] - 1;
+            setBitboardBit(&packer->starts[classI][isVertical], start.y, start.x);
+        }
+    }
 
-    getShipElementsOfPlayer(game->players[enemyIndex], shipElements);
+    packer->slack = grownSizeY * grownSizeX - neededFields;
+    packer->wastedCount = 0;
+    packer->wastedFields = (int*) arenaAlloc(scratch, grownSizeY * grownSizeX * sizeof(int));
+    packer->packed = (PackedShip*) arenaAlloc(scratch, packer->shipsCount * sizeof(PackedShip));
+}
 
-    for(int elI = 0; elI < shipElements->length; elI++) {
-        if(canShipSee(s, shipElements->ptr[elI].pos)) {
-            if(!isShotAt(shipElements->ptr[elI].ship, shipElements->ptr[elI].nth)) {
-                int modX, modY;
-                getShipDirMods(&s, &modY, &modX);
-                Point cannonPos = s.headPos;
-                cannonPos.y += modY;
-                cannonPos.x += modX;
-                if(arePointsInRange(cannonPos, shipElements->ptr[elI].pos, s.size)) {
-                    shipElementVecPushBack(elements, shipElements->ptr[elI]);
-                }
+void markGrownRect(FleetPacker* packer, PackedShip* ship, int isDecided) {
+    int sizeY = ship->isVertical ? shipsSizes[ship->classIndex] + 1 : 2;
+    int sizeX = ship->isVertical ? 2 : shipsSizes[ship->classIndex] + 1;
+    for(int y = ship->start.y; y < ship->start.y + sizeY; y++) {
+        for(int x = ship->start.x; x < ship->start.x + sizeX; x++) {
+            if(isDecided) {
+                setBitboardBit(&packer->decided, y, x);
+            } else {
+                clearBitboardBit(&packer->decided, y, x);
             }
         }
     }
+}
+
+int64_t getMonotonicMillis() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
-    free(shipElements->ptr);
-    free(shipElements);
+/* Every field before the first undecided one is covered or left empty, so a ship covering that field
+ * has to start there. Biggest ships, which fit in the fewest places, are tried first. */
+enum PackResult packShipsAt(FleetPacker* packer, int y, int x, int depth) {
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        if(packer->shipsLeft[classI] == 0) continue;
+        int firstVertical = gameRandom(packer->generator->game) % 2;
+        for(int orientationI = 0; orientationI < 2; orientationI++) {
+            PackedShip ship = {classI, firstVertical ^ orientationI, pointOf(y, x)};
+            if(!testBitboardBit(&packer->starts[classI][ship.isVertical], y, x)) continue;
+            int endY = y + (ship.isVertical ? shipsSizes[classI] : 1);
+            int endX = x + (ship.isVertical ? 1 : shipsSizes[classI]);
+            if(isAnyBitInRect(&packer->decided, y, x, endY, endX)) continue;
+
+            markGrownRect(packer, &ship, true);
+            packer->shipsLeft[classI]--;
+            packer->packed[depth] = ship;
+            enum PackResult result = packFleetFrom(packer, y * packer->decided.sizeX + x + 1, depth + 1);
+            if(result != PACK_INFEASIBLE) return result;
+            markGrownRect(packer, &ship, false);
+            packer->shipsLeft[classI]++;
+        }
+    }
+    return PACK_INFEASIBLE;
 }
 
-void getEnemyShipElementsSeenBy(int playerIndex, Game* game, ShipElementVec* elements) {
-    ShipElementVec* enemyShipElements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-    initShipElementVec(enemyShipElements);
+/* Undecided fields are visited in order, each one is either covered by a ship starting there or left
+ * empty. At most slack fields can be left empty, otherwise the ships left do not have enough room. */
+enum PackResult packFleetFrom(FleetPacker* packer, int field, int depth) {
+    if(depth == packer->shipsCount) return PACK_FOUND;
 
-    getShipElementsOfPlayer(game->players[playerIndex], enemyShipElements);
+    int wastedBefore = packer->wastedCount;
+    int fieldsCount = packer->decided.sizeY * packer->decided.sizeX;
+    enum PackResult result = PACK_INFEASIBLE;
+    for(; field < fieldsCount; field++) {
+        int y = field / packer->decided.sizeX;
+        int x = field % packer->decided.sizeX;
+        if(testBitboardBit(&packer->decided, y, x)) continue;
 
-    // Iterate over enemy ship elements and add only those which are in radars line of sight
-    for(int elI = 0; elI < enemyShipElements->length; elI++) {
-        if(canPlayerSee(playerIndex, enemyShipElements->ptr[elI].pos, game)) {
-            shipElementVecPushBack(elements, enemyShipElements->ptr[elI]);
+        packer->nodesCount++;
+        if(packer->nodesCount % FLEET_PACKER_CLOCK_INTERVAL == 0 && getMonotonicMillis() > packer->deadline) {
+            result = PACK_TIMEOUT;
+            break;
         }
+        result = packShipsAt(packer, y, x, depth);
+        if(result != PACK_INFEASIBLE || packer->wastedCount == packer->slack) break;
+
+        setBitboardBit(&packer->decided, y, x);
+        packer->wastedFields[packer->wastedCount++] = field;
+    }
+
+    while(result == PACK_INFEASIBLE && packer->wastedCount > wastedBefore) {
+        int wasted = packer->wastedFields[--packer->wastedCount];
+        clearBitboardBit(&packer->decided, wasted / packer->decided.sizeX, wasted % packer->decided.sizeX);
     }
+    return result;
+}
 
-    free(enemyShipElements->ptr);
-    free(enemyShipElements);
+enum PackResult packFleet(FleetPacker* packer) {
+    if(packer->slack < 0) return PACK_INFEASIBLE;
+    packer->deadline = getMonotonicMillis() + FLEET_PACKER_TIME_BUDGET_MS;
+    return packFleetFrom(packer, 0, 0);
 }
 
-void getShipElementsSeenBy(int playerIndex, Game* game, ShipElementVec* elements) {
-    ShipElementVec* enemyShipElements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-    initShipElementVec(enemyShipElements);
+// Packed ships are given to unplaced ships of their classes, either end of a ship can be its head
+int getPackedLayout(FleetPacker* packer, Player* player, AIPlacement* layout) {
+    Point areaStart = packer->generator->area.start;
+    Fleet* fleet = &player->fleet;
+    int count = 0;
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        int shipId = fleet->classStarts[classI];
+        int size = shipsSizes[classI];
+        for(int depth = 0; depth < packer->shipsCount; depth++) {
+            PackedShip* packed = &packer->packed[depth];
+            if(packed->classIndex != classI) continue;
+            while(fleet->flags[shipId] & SHIP_PLACED) shipId++;
+
+            int isReversed = gameRandom(packer->generator->game) % 2;
+            PlacementCandidate candidate;
+            candidate.head = pointOf(areaStart.y + packed->start.y, areaStart.x + packed->start.x);
+            if(packed->isVertical) {
+                candidate.direction = isReversed ? S : N;
+                if(isReversed) candidate.head.y += size - 1;
+            } else {
+                candidate.direction = isReversed ? E : W;
+                if(isReversed) candidate.head.x += size - 1;
+            }
+            layout[count].shipId = shipId++;
+            layout[count++].candidate = candidate;
+        }
+    }
+    return count;
+}
 
-    getShipElementsOfPlayer(game->players[game->nextPlayerIndex], enemyShipElements);
+// Fills the layout with ships put one by one at candidates drawn uniformly, returns how many were put
+int sampleGreedyLayout(PlacementGenerator* generator, Player* player, AIPlacement* layout) {
+    Fleet* fleet = &player->fleet;
+    int count = 0;
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        PlacementSet* set = &generator->sets[classI];
+        for(int shipId = fleet->classStarts[classI]; shipId < fleet->classStarts[classI + 1]; shipId++) {
+            if((fleet->flags[shipId] & SHIP_PLACED) || set->count == 0) continue;
+
+            PlacementCandidate candidate = set->candidates[gameRandom(generator->game) % set->count];
+            Ship placed = getFleetShip(fleet, shipId);
+            placed.headPos = candidate.head;
+            placed.direction = candidate.direction;
+            excludePlacementsAround(generator, &placed);
+            layout[count].shipId = shipId;
+            layout[count++].candidate = candidate;
+        }
+    }
+    return count;
+}
+
+void aiPutShip(Player* aiPlayerCp, Game* copyOfGame, int shipId, PlacementCandidate candidate) {
+    Fleet* fleet = &aiPlayerCp->fleet;
+    fleet->heads[shipId] = candidate.head;
+    fleet->directions[shipId] = (unsigned char) candidate.direction;
+    fleet->flags[shipId] |= SHIP_PLACED;
+    addPlacedShipParts(aiPlayerCp, shipId);
+    Ship shipToPlace = getFleetShip(fleet, shipId);
+    addShipToBoard(copyOfGame, aiPlayerCp == &copyOfGame->players[0] ? 0 : 1, &shipToPlace);
+
+    gamePrintf(copyOfGame, "PLACE_SHIP %d %d %c %d %s\n",
+           candidate.head.y,
+           candidate.head.x,
+           candidate.direction,
+           shipId - fleet->classStarts[getFleetShipClass(fleet, shipId)],
+           getClassNameBySize(shipToPlace.size)
+    );
+}
+
+/* Initial position areas too big for placement sets are filled by trying random heads and directions,
+ * each checked in O(1), ships are so sparse there that a few attempts are enough. Ships which do not fit are left unplaced. */
+void aiPlaceShipsRandomly(Player* aiPlayerCp, Game* copyOfGame) {
+    Rectangle area = aiPlayerCp->initArea;
+    int areaSizeY = area.end.y - area.start.y + 1;
+    int areaSizeX = area.end.x - area.start.x + 1;
+    Fleet* fleet = &aiPlayerCp->fleet;
+    for(int shipId = 0; shipId < getFleetShipsCount(fleet); shipId++) {
+        if(fleet->flags[shipId] & SHIP_PLACED) continue;
+
+        for(int attemptI = 0; attemptI < AI_SPARSE_ATTEMPTS; attemptI++) {
+            PlacementCandidate candidate;
+            candidate.head = pointOf(area.start.y + gameRandom(copyOfGame) % areaSizeY,
+                                     area.start.x + gameRandom(copyOfGame) % areaSizeX);
+            candidate.direction = directions[gameRandom(copyOfGame) % DIRECTIONS_COUNT];
+            Ship placed = getFleetShip(fleet, shipId);
+            placed.headPos = candidate.head;
+            placed.direction = candidate.direction;
+            if(isShipRightPlaced(copyOfGame, aiPlayerCp, &placed)) {
+                aiPutShip(aiPlayerCp, copyOfGame, shipId, candidate);
+                break;
+            }
+        }
+    }
+}
 
-    // All ships of a player is seen by the player
-    getShipElementsOfPlayer(game->players[playerIndex], elements);
+/* Uniformly random layouts are tried first. If none of them holds the whole fleet, it is packed by
+ * the solver, and if even that fails the biggest random layout is used. */
+void aiPlaceShips(Player* aiPlayerCp, Game* copyOfGame) {
+    Rectangle area = aiPlayerCp->initArea;
+    int64_t areaFields = (int64_t) (area.end.y - area.start.y + 1) * (area.end.x - area.start.x + 1);
+    if(area.end.y >= area.start.y && area.end.x >= area.start.x && areaFields > AI_PLACEMENT_MAX_FIELDS) {
+        aiPlaceShipsRandomly(aiPlayerCp, copyOfGame);
+        return;
+    }
+
+    Arena* scratch = &copyOfGame->session->scratch;
+    ArenaMark mark = getArenaMark(scratch);
+    int shipsCount = 0;
+    for(int shipId = 0; shipId < getFleetShipsCount(&aiPlayerCp->fleet); shipId++) {
+        shipsCount += !(aiPlayerCp->fleet.flags[shipId] & SHIP_PLACED);
+    }
+    AIPlacement* layout = (AIPlacement*) arenaAlloc(scratch, shipsCount * sizeof(AIPlacement));
+    AIPlacement* bestLayout = (AIPlacement*) arenaAlloc(scratch, shipsCount * sizeof(AIPlacement));
+    int bestCount = -1;
+
+    PlacementGenerator generator;
+    initPlacementGenerator(&generator, copyOfGame, aiPlayerCp);
+    for(int attemptI = 0; attemptI < AI_RANDOM_LAYOUT_ATTEMPTS && bestCount < shipsCount; attemptI++) {
+        int count = sampleGreedyLayout(&generator, aiPlayerCp, layout);
+        if(count > bestCount) {
+            memcpy(bestLayout, layout, count * sizeof(AIPlacement));
+            bestCount = count;
+        }
+        restorePlacementCandidates(&generator, 0);
+    }
 
-    // Iterate over enemy ship elements and add only those which are in radars line of sight
-    getEnemyShipElementsSeenBy(playerIndex, game, elements);
+    if(bestCount < shipsCount) {
+        FleetPacker packer;
+        initFleetPacker(&packer, &generator, aiPlayerCp);
+        if(packFleet(&packer) == PACK_FOUND) bestCount = getPackedLayout(&packer, aiPlayerCp, bestLayout);
+    }
 
-    free(enemyShipElements->ptr);
-    free(enemyShipElements);
+    for(int placementI = 0; placementI < bestCount; placementI++) {
+        aiPutShip(aiPlayerCp, copyOfGame, bestLayout[placementI].shipId, bestLayout[placementI].candidate);
+    }
+    resetArenaToMark(scratch, mark);
 }
 
-void aiShoot(int playerIndex, Game* game) {
-    if(!areAllShipsPlaced(game->players)) return;
+/* Whole grid is built from scratch when the remaining fleet changes, otherwise it is updated per field.
+ * Boards with more than AI_TABLE_MAX_FIELDS fields get no grids, see chooseSparseTarget. */
+void initTargetingEngine(TargetingEngine* engine, Game* game, int playerIndex) {
+    Arena* scratch = &game->session->scratch;
+    size_t cellsCount = (size_t) game->planeSizeY * game->planeSizeX;
+    engine->game = game;
+    engine->playerIndex = playerIndex;
+    engine->enemyIndex = !playerIndex;
+    engine->knowledge = NULL;
+    engine->density = NULL;
 
-    Player* aiPlayer = game->players[playerIndex];
+    // Ships which cannot move stay where they were placed, in the initial position area
+    Player* enemy = &game->players[engine->enemyIndex];
+    engine->fleetArea = game->extendedShips
+                        ? (Rectangle) {pointOf(0, 0), pointOf(game->planeSizeY - 1, game->planeSizeX - 1)}
+                        : enemy->initArea;
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        engine->remainingCounts[classI] = 0;
+        for(int shipId = enemy->fleet.classStarts[classI]; shipId < enemy->fleet.classStarts[classI + 1]; shipId++) {
+            if(!(enemy->fleet.flags[shipId] & SHIP_SUNK)) engine->remainingCounts[classI]++;
+        }
+    }
+    if(cellsCount > AI_TABLE_MAX_FIELDS) return;
 
-    if(game->extendedShips) {
-        for(int classI = 0; classI < TYPES_COUNT; classI++) {
-            for(int shipI = 0; shipI < aiPlayer->typesCounts[classI]; shipI++) {
-                Ship s = aiPlayer->ships[classI][shipI];
-                if(!s.isPlaced || isShotAt(&s, 1)) continue;
-
-                ShipElementVec* seenEnemyElements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-                initShipElementVec(seenEnemyElements);
-
-                int shotsRemaining = s.size;
-
-                for(int i = 0; i < shotsRemaining; i++) {
-                    shipElementVecReset(seenEnemyElements);
-                    getEnemyElementsToShoot(!playerIndex, s, game, seenEnemyElements);
-
-                    if(seenEnemyElements->length > 0) {
-                        int randI = rand() % seenEnemyElements->length;
-
-                        int modY, modX;
-                        getShipDirMods(&s, &modY, &modX);
-                        Point cannonPos = s.headPos;
-                        cannonPos.y += modY;
-                        cannonPos.x += modX;
-                        ShipElement choosen = seenEnemyElements->ptr[randI];
-
-                        if(!arePointsInRange(choosen.pos, cannonPos, s.size)) {
-                            shotsRemaining++;
-                            continue;
-                        }
-
-                        printf("SHOOT %d %s %d %d\n",
-                               s.ID,
-                               getClassNameBySize(s.size),
-                               choosen.pos.y,
-                               choosen.pos.x
-                        );
-                    } else {
-                        int randX, randY;
-                        int modY, modX;
-                        getShipDirMods(&s, &modY, &modX);
-                        Point cannonPos = s.headPos;
-                        cannonPos.y += modY;
-                        cannonPos.x += modX;
-                        int shootingAtOwnShip;
-                        int j = 0;
-                        do {
-                            shootingAtOwnShip = false;
-                            j++;
-                            randX = rand() % game->planeSizeX;
-                            randY = rand() % game->planeSizeY;
-                            ShipElementVec* ownElements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-                            initShipElementVec(ownElements);
-                            getShipElementsOfPlayer(aiPlayer, ownElements);
-
-                            for(int elI = 0; elI < ownElements->length; elI++) {
-                                ShipElement el = ownElements->ptr[elI];
-                                if(el.pos.y == randY && el.pos.x == randX) {
-                                    shootingAtOwnShip = true;
-                                    break;
-                                }
-                            }
-
-                            free(ownElements->ptr);
-                            free(ownElements);
-                        } while(!(arePointsInRange(cannonPos, pointOf(randY, randX), s.size)) || shootingAtOwnShip);
-
-                        printf("SHOOT %d %s %d %d\n",
-                               s.ID,
-                               getClassNameBySize(s.size),
-                               randY,
-                               randX
-                        );
-                    }
+    engine->knowledge = (unsigned char*) arenaAlloc(scratch, cellsCount * sizeof(unsigned char));
+    engine->density = (int64_t*) arenaAlloc(scratch, cellsCount * sizeof(int64_t));
+    for(int y = 0; y < game->planeSizeY; y++) {
+        for(int x = 0; x < game->planeSizeX; x++) {
+            engine->knowledge[y * game->planeSizeX + x] = (unsigned char) getInitialKnowledge(engine, y, x);
+        }
+    }
+    rebuildTargetingDensity(engine);
+}
+
+/* Player knows results of its own shots and everything it sees. Sunk ships are known to everyone,
+ * fields of its own ships and reefs cannot hold an enemy ship. */
+enum TargetKnowledge getInitialKnowledge(TargetingEngine* engine, int y, int x) {
+    Game* game = engine->game;
+    if(testBitboardBit(&game->reefsMap, y, x)) return TARGET_BLOCKED;
+    if(testBitboardBit(&game->shipsMaps[engine->playerIndex], y, x)) return TARGET_BLOCKED;
+
+    int isKnown = testBitboardBit(&game->shotsMaps[engine->playerIndex], y, x)
+                  || testBitboardBit(&game->visibilityMaps[engine->playerIndex], y, x);
+    if(!testBitboardBit(&game->shipsMaps[engine->enemyIndex], y, x)) {
+        return isKnown ? TARGET_MISS : TARGET_UNKNOWN;
+    }
+
+    const ShipCell* cell = getShipCellAt(game, y, x);
+    if(getCellFleet(game, cell)->flags[cell->shipId] & SHIP_SUNK) return TARGET_BLOCKED;
+    if(!isKnown) return TARGET_UNKNOWN;
+    return testBitboardBit(&game->hitsMaps[engine->enemyIndex], y, x) ? TARGET_HIT : TARGET_SHIP;
+}
+
+// Every field known to hold a part of an enemy ship multiplies the weight of placements covering it
+int64_t getPlacementWeight(TargetingEngine* engine, int classIndex, int startY, int startX, int modY, int modX) {
+    Game* game = engine->game;
+    int size = shipsSizes[classIndex];
+    Point start = pointOf(startY, startX);
+    Point end = pointOf(startY + (size - 1) * modY, startX + (size - 1) * modX);
+    if(!isInsideBoard(game, start.y, start.x) || !isInsideBoard(game, end.y, end.x)) return 0;
+    if(!isPointInsideRect(&engine->fleetArea, &start) || !isPointInsideRect(&engine->fleetArea, &end)) return 0;
+
+    int64_t weight = engine->remainingCounts[classIndex];
+    for(int partI = 0; partI < size; partI++) {
+        unsigned char knowledge = engine->knowledge[(startY + partI * modY) * game->planeSizeX + startX + partI * modX];
+        if(knowledge == TARGET_MISS || knowledge == TARGET_BLOCKED) return 0;
+        if(knowledge == TARGET_HIT || knowledge == TARGET_SHIP) weight *= TARGET_KNOWN_PART_BOOST;
+    }
+    return weight;
+}
+
+void addPlacementDensity(TargetingEngine* engine, int classIndex, int startY, int startX, int modY, int modX,
+                         int64_t weight) {
+    for(int partI = 0; partI < shipsSizes[classIndex]; partI++) {
+        engine->density[(startY + partI * modY) * engine->game->planeSizeX + startX + partI * modX] += weight;
+    }
+}
+
+void rebuildTargetingDensity(TargetingEngine* engine) {
+    Game* game = engine->game;
+    memset(engine->density, 0, game->planeSizeY * game->planeSizeX * sizeof(int64_t));
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        if(engine->remainingCounts[classI] == 0) continue;
+        for(int dirI = 0; dirI < 2; dirI++) {
+            int modY = dirI, modX = !dirI;
+            for(int y = 0; y < game->planeSizeY; y++) {
+                for(int x = 0; x < game->planeSizeX; x++) {
+                    int64_t weight = getPlacementWeight(engine, classI, y, x, modY, modX);
+                    if(weight > 0) addPlacementDensity(engine, classI, y, x, modY, modX, weight);
                 }
+            }
+        }
+    }
+}
 
-                free(seenEnemyElements->ptr);
-                free(seenEnemyElements);
+// Adds (or takes away for sign -1) weights of all placements covering the field
+void addDensityThrough(TargetingEngine* engine, int y, int x, int sign) {
+    for(int classI = 0; classI < TYPES_COUNT; classI++) {
+        if(engine->remainingCounts[classI] == 0) continue;
+        for(int dirI = 0; dirI < 2; dirI++) {
+            int modY = dirI, modX = !dirI;
+            for(int partI = 0; partI < shipsSizes[classI]; partI++) {
+                int startY = y - partI * modY;
+                int startX = x - partI * modX;
+                int64_t weight = getPlacementWeight(engine, classI, startY, startX, modY, modX);
+                if(weight > 0) addPlacementDensity(engine, classI, startY, startX, modY, modX, sign * weight);
             }
         }
-    } else {
-        ShipElementVec* seenEnemyElements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-        initShipElementVec(seenEnemyElements);
-        getEnemyShipElementsSeenBy(playerIndex, game, seenEnemyElements);
+    }
+}
 
-        if(seenEnemyElements->length > 0) {
-            int randEl = rand() % seenEnemyElements->length;
-            ShipElement choosen = seenEnemyElements->ptr[randEl];
+void setTargetKnowledge(TargetingEngine* engine, int y, int x, enum TargetKnowledge knowledge) {
+    addDensityThrough(engine, y, x, -1);
+    engine->knowledge[y * engine->game->planeSizeX + x] = (unsigned char) knowledge;
+    addDensityThrough(engine, y, x, 1);
+}
 
-            printf("SHOOT %d %d\n", choosen.pos.y, choosen.pos.x);
-        } else {
-            int randY, randX;
-            int shootingAtOwnShip = false;
-
-            do {
-                randY = rand() % game->planeSizeY;
-                randX = rand() % game->planeSizeX;
-                ShipElementVec* ownElements = (ShipElementVec*) malloc(sizeof(ShipElementVec));
-                initShipElementVec(ownElements);
-                getShipElementsOfPlayer(aiPlayer, ownElements);
-
-                for(int elI = 0; elI < ownElements->length; elI++) {
-                    ShipElement el = ownElements->ptr[elI];
-                    if(el.pos.y == randY && el.pos.x == randX) {
-                        shootingAtOwnShip = true;
-                    }
-                }
+// Player learns the result of its shot, a ship with all parts hit is sunk and leaves the fleet
+void recordTargetingShot(TargetingEngine* engine, int y, int x) {
+    Game* game = engine->game;
+    if(engine->knowledge == NULL) {
+        // Game is a copy, so the shot map may remember shots of the AI move
+        setBitboardBit(&game->shotsMaps[engine->playerIndex], y, x);
+        return;
+    }
+
+    if(!testBitboardBit(&game->shipsMaps[engine->enemyIndex], y, x)) {
+        setTargetKnowledge(engine, y, x, TARGET_MISS);
+        return;
+    }
+    setTargetKnowledge(engine, y, x, TARGET_HIT);
 
-                free(ownElements->ptr);
-                free(ownElements);
-            } while(shootingAtOwnShip);
+    const ShipCell* cell = getShipCellAt(game, y, x);
+    Ship ship = getFleetShip(getCellFleet(game, cell), cell->shipId);
+    int modY, modX;
+    getShipDirMods(&ship, &modY, &modX);
+    for(int partI = 0; partI < ship.size; partI++) {
+        int partY = ship.headPos.y + partI * modY;
+        int partX = ship.headPos.x + partI * modX;
+        if(!isInsideBoard(game, partY, partX)) continue;
+        if(engine->knowledge[partY * game->planeSizeX + partX] != TARGET_HIT) return;
+    }
+
+    for(int partI = 0; partI < ship.size; partI++) {
+        int partY = ship.headPos.y + partI * modY;
+        int partX = ship.headPos.x + partI * modX;
+        if(isInsideBoard(game, partY, partX)) engine->knowledge[partY * game->planeSizeX + partX] = TARGET_BLOCKED;
+    }
+    engine->remainingCounts[getClassIndexBySize(ship.size)]--;
+    rebuildTargetingDensity(engine);
+}
+
+/* Known but not yet hit parts of enemy ships go first, then the densest field. Only fields of the
+ * rectangle which are in range of the shooter (NULL for any field) and were not shot are considered,
+ * ties are broken randomly. Returns 0 if there is no such field. */
+int chooseTarget(TargetingEngine* engine, Ship* shooter, Rectangle area, Point* target) {
+    Game* game = engine->game;
+    if(area.start.y < 0) area.start.y = 0;
+    if(area.start.x < 0) area.start.x = 0;
+    if(area.end.y > game->planeSizeY - 1) area.end.y = game->planeSizeY - 1;
+    if(area.end.x > game->planeSizeX - 1) area.end.x = game->planeSizeX - 1;
+    if(engine->knowledge == NULL) return chooseSparseTarget(engine, shooter, area, target);
+
+    int bestIsShip = false;
+    int64_t bestDensity = -1;
+    int tiesCount = 0;
+    for(int y = area.start.y; y <= area.end.y; y++) {
+        for(int x = area.start.x; x <= area.end.x; x++) {
+            unsigned char knowledge = engine->knowledge[y * game->planeSizeX + x];
+            if(knowledge != TARGET_UNKNOWN && knowledge != TARGET_SHIP) continue;
+            if(shooter != NULL && !isInCannonRange(shooter, y, x)) continue;
+
+            int isShip = knowledge == TARGET_SHIP;
+            int64_t density = engine->density[y * game->planeSizeX + x];
+            if(isShip < bestIsShip || (isShip == bestIsShip && density < bestDensity)) continue;
+            if(isShip > bestIsShip || density > bestDensity) {
+                bestIsShip = isShip;
+                bestDensity = density;
+                tiesCount = 0;
+            }
 
-            printf("SHOOT %d %d\n", randY, randX);
+            tiesCount++;
+            if(gameRandom(game) % tiesCount == 0) *target = pointOf(y, x);
         }
+    }
+    return tiesCount > 0;
+}
+
+/* Boards without grids are shot without densities. Known but not yet hit parts of enemy ships still
+ * go first, otherwise random fields of the area lying in the fleet area are tried. */
+int chooseSparseTarget(TargetingEngine* engine, Ship* shooter, Rectangle area, Point* target) {
+    Game* game = engine->game;
+    int tiesCount = 0;
+    BitboardCursor cursor;
+    initBitboardCursor(&cursor);
+    int y, x;
+    while(nextBitboardBit(&game->shipsMaps[engine->enemyIndex], &cursor, &y, &x)) {
+        Point part = pointOf(y, x);
+        if(!isPointInsideRect(&area, &part)) continue;
+        if(shooter != NULL && !isInCannonRange(shooter, y, x)) continue;
+        if(getInitialKnowledge(engine, y, x) != TARGET_SHIP) continue;
+
+        tiesCount++;
+        if(gameRandom(game) % tiesCount == 0) *target = part;
+    }
+    if(tiesCount > 0) return true;
+
+    Rectangle fleetArea = engine->fleetArea;
+    if(area.start.y < fleetArea.start.y) area.start.y = fleetArea.start.y;
+    if(area.start.x < fleetArea.start.x) area.start.x = fleetArea.start.x;
+    if(area.end.y > fleetArea.end.y) area.end.y = fleetArea.end.y;
+    if(area.end.x > fleetArea.end.x) area.end.x = fleetArea.end.x;
+    if(area.start.y > area.end.y || area.start.x > area.end.x) return false;
+
+    for(int attemptI = 0; attemptI < AI_SPARSE_ATTEMPTS; attemptI++) {
+        y = area.start.y + gameRandom(game) % (area.end.y - area.start.y + 1);
+        x = area.start.x + gameRandom(game) % (area.end.x - area.start.x + 1);
+        if(shooter != NULL && !isInCannonRange(shooter, y, x)) continue;
+        if(getInitialKnowledge(engine, y, x) != TARGET_UNKNOWN) continue;
+        *target = pointOf(y, x);
+        return true;
+    }
+    return false;
+}
+
+void aiShoot(int playerIndex, Game* game) {
+    if(!areAllShipsPlaced(game->players)) return;
+
+    Player* aiPlayer = &game->players[playerIndex];
+    ArenaMark mark = getArenaMark(&game->session->scratch);
+    TargetingEngine engine;
+    initTargetingEngine(&engine, game, playerIndex);
+
+    Rectangle wholeBoard = {pointOf(0, 0), pointOf(game->planeSizeY - 1, game->planeSizeX - 1)};
+    Point target;
+    if(game->extendedShips) {
+        Fleet* fleet = &aiPlayer->fleet;
+        for(int classI = 0; classI < TYPES_COUNT; classI++) {
+            for(int shipI = 0; shipI < aiPlayer->typesCounts[classI]; shipI++) {
+                int shipId = fleet->classStarts[classI] + shipI;
+                Ship s = getFleetShip(fleet, shipId);
+                if(!(fleet->flags[shipId] & SHIP_PLACED) || isShotAt(&s, 1)) continue;
+
+                // Only fields around the cannon can be in range, except for carriers
+                Rectangle area = wholeBoard;
+                if(classI != CARRIERS) {
+                    int modY, modX;
+                    getShipDirMods(&s, &modY, &modX);
+                    Point cannonPos = pointOf(s.headPos.y + modY, s.headPos.x + modX);
+                    area.start = pointOf(cannonPos.y - s.size, cannonPos.x - s.size);
+                    area.end = pointOf(cannonPos.y + s.size, cannonPos.x + s.size);
+                }
+
+                for(int shotI = 0; shotI < s.size; shotI++) {
+                    if(!chooseTarget(&engine, &s, area, &target)) break;
+                    recordTargetingShot(&engine, target.y, target.x);
 
-        free(seenEnemyElements->ptr);
-        free(seenEnemyElements);
+                    gamePrintf(game, "SHOOT %d %s %d %d\n",
+                           shipI,
+                           getClassNameBySize(s.size),
+                           target.y,
+                           target.x
+                    );
+                }
+            }
+        }
+    } else if(chooseTarget(&engine, NULL, wholeBoard, &target)) {
+        gamePrintf(game, "SHOOT %d %d\n", target.y, target.x);
     }
+
+    resetArenaToMark(&game->session->scratch, mark);
 }
 
 void handleAI(Game* game) {
-    Game* copyOfGame = (Game*) malloc(sizeof(Game));
-    copyGame(copyOfGame, game);
+    STATS_START(start);
+    Game* copyOfGame = (Game*) calloc(1, sizeof(Game));
+    cloneGame(copyOfGame, game);
     copyOfGame->nextPlayerIndex = !copyOfGame->nextPlayerIndex;
 
     int aiPlayerIndex = !copyOfGame->nextPlayerIndex;
-    Player* aiPlayerCp = copyOfGame->players[aiPlayerIndex];
+    Player* aiPlayerCp = &copyOfGame->players[aiPlayerIndex];
 
-    srand(game->randomSeed);
     saveGame(copyOfGame);
 
+    // Copy shares the session, so AI output goes to the output of the game
     char playerX = getCharOfPlayerIndex(aiPlayerIndex);
-    printf("[state]\nPRINT 0\n[state]\n");
-    printf("[player%c]\n", playerX);
+    gamePrintf(copyOfGame, "[state]\nPRINT 0\n[state]\n");
+    gamePrintf(copyOfGame, "[player%c]\n", playerX);
 
     aiPlaceShips(aiPlayerCp, copyOfGame);
     aiShoot(aiPlayerIndex, copyOfGame);
 //    aiMove(aiPlayerIndex, copyOfGame);
 
-    printf("[player%c]\n", playerX);
-    printf("[state]\nPRINT 0\n[state]\n");
+    gamePrintf(copyOfGame, "[player%c]\n", playerX);
+    gamePrintf(copyOfGame, "[state]\nPRINT 0\n[state]\n");
     game->shouldEnd = true;
-    freeGame(copyOfGame);
+    flushGameOutput(copyOfGame);
+    freeGameClone(copyOfGame);
+    resetArena(&game->session->scratch);
+    STATS_STOP(STATS_HANDLE_AI, start, 0);
 }
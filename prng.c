@@ -0,0 +1,62 @@
+#include "prng.h"
+
+uint64_t prngRotateLeft(uint64_t value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+// State words are filled by splitmix64, so even close seeds give unrelated, never all zero states
+void seedPrng(PrngState* state, uint64_t seed) {
+    for(int wordI = 0; wordI < PRNG_STATE_WORDS; wordI++) {
+        seed += 0x9e3779b97f4a7c15ULL;
+        uint64_t mixed = seed;
+        mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebULL;
+        state->words[wordI] = mixed ^ (mixed >> 31);
+    }
+}
+
+uint64_t nextPrng(PrngState* state) {
+    uint64_t* s = state->words;
+    uint64_t result = prngRotateLeft(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = prngRotateLeft(s[3], 45);
+
+    return result;
+}
+
+const uint64_t prngJumpPolynomial[PRNG_STATE_WORDS] = {
+    0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+};
+
+// Advances the state by 2^128 steps, so the jumped stream does not overlap the one it came from
+void jumpPrng(PrngState* state) {
+    uint64_t jumped[PRNG_STATE_WORDS] = {0, 0, 0, 0};
+    for(int jumpI = 0; jumpI < PRNG_STATE_WORDS; jumpI++) {
+        for(int bit = 0; bit < 64; bit++) {
+            if(prngJumpPolynomial[jumpI] & ((uint64_t) 1 << bit)) {
+                for(int wordI = 0; wordI < PRNG_STATE_WORDS; wordI++) {
+                    jumped[wordI] ^= state->words[wordI];
+                }
+            }
+            nextPrng(state);
+        }
+    }
+
+    for(int wordI = 0; wordI < PRNG_STATE_WORDS; wordI++) {
+        state->words[wordI] = jumped[wordI];
+    }
+}
+
+// All zero state is the only one the generator never leaves
+int isPrngStateValid(const PrngState* state) {
+    for(int wordI = 0; wordI < PRNG_STATE_WORDS; wordI++) {
+        if(state->words[wordI] != 0) return 1;
+    }
+    return 0;
+}
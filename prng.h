@@ -0,0 +1,18 @@
+#ifndef CBATTLESHIPS_PRNG_H
+#define CBATTLESHIPS_PRNG_H
+
+#include <stdint.h>
+
+#define PRNG_STATE_WORDS 4
+
+// xoshiro256** generator. The state is plain data, so it can be copied, saved and restored as it is
+typedef struct {
+    uint64_t words[PRNG_STATE_WORDS];
+} PrngState;
+
+void seedPrng(PrngState* state, uint64_t seed);
+uint64_t nextPrng(PrngState* state);
+void jumpPrng(PrngState* state);
+int isPrngStateValid(const PrngState* state);
+
+#endif //CBATTLESHIPS_PRNG_H
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "reader.h"
+
+#define READER_INITIAL_CAPACITY (1 << 16)
+
+void initLineReader(LineReader* reader, int fd) {
+    reader->fd = fd;
+    reader->capacity = READER_INITIAL_CAPACITY;
+    reader->buffer = (char*) malloc(reader->capacity);
+    reader->start = 0;
+    reader->end = 0;
+    reader->isEOF = 0;
+}
+
+// Moves not consumed bytes to the front of the buffer (growing it if the line does
+// not fit) and reads as much as fits after them
+void fillLineReader(LineReader* reader) {
+    size_t pending = reader->end - reader->start;
+    if(reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start, pending);
+        reader->start = 0;
+        reader->end = pending;
+    }
+
+    // One byte is always left for the terminating '\0'
+    if(reader->end + 1 >= reader->capacity) {
+        reader->capacity *= 2;
+        reader->buffer = (char*) realloc(reader->buffer, reader->capacity);
+    }
+
+    ssize_t readBytes;
+    do {
+        readBytes = read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end - 1);
+    } while(readBytes < 0 && errno == EINTR);
+
+    if(readBytes <= 0) {
+        reader->isEOF = 1;
+    } else {
+        reader->end += readBytes;
+    }
+}
+
+// Return 0 or -1 if input has ended before end of the line
+// Line stays valid (and may be modified) until the next call
+int readLine(LineReader* reader, char** line) {
+    size_t searchFrom = reader->start;
+    char* newLine = NULL;
+
+    while(!reader->isEOF) {
+        newLine = memchr(reader->buffer + searchFrom, '\n', reader->end - searchFrom);
+        if(newLine != NULL) break;
+
+        size_t scanned = reader->end - reader->start;
+        fillLineReader(reader);
+        searchFrom = reader->start + scanned;
+    }
+
+    *line = reader->buffer + reader->start;
+
+    if(newLine == NULL) {
+        reader->buffer[reader->end] = '\0';
+        reader->start = reader->end;
+        return -1;
+    }
+
+    *newLine = '\0';
+    reader->start = newLine - reader->buffer + 1;
+    return 0;
+}
+
+// True if the next line can be read without waiting for the input
+int hasBufferedLine(LineReader* reader) {
+    return memchr(reader->buffer + reader->start, '\n', reader->end - reader->start) != NULL;
+}
+
+void freeLineReader(LineReader* reader) {
+    free(reader->buffer);
+    reader->buffer = NULL;
+    reader->capacity = 0;
+}
@@ -0,0 +1,21 @@
+#ifndef CBATTLESHIPS_READER_H
+#define CBATTLESHIPS_READER_H
+
+#include <stddef.h>
+
+// Reads input in big blocks and hands out lines sliced in place from its buffer
+typedef struct {
+    int fd;
+    char* buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    int isEOF;
+} LineReader;
+
+void initLineReader(LineReader* reader, int fd);
+int readLine(LineReader* reader, char** line);
+int hasBufferedLine(LineReader* reader);
+void freeLineReader(LineReader* reader);
+
+#endif //CBATTLESHIPS_READER_H
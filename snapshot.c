@@ -0,0 +1,48 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+// Returns 0 or -1 if the file could not be written
+int writeSnapshotFile(const char* path, const void* data, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1) return -1;
+
+    const char* bytes = (const char*) data;
+    while(size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if(written == -1) {
+            if(errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return close(fd);
+}
+
+// Returns read only mapping of the whole file or NULL if it could not be mapped
+const void* mapSnapshotFile(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return NULL;
+
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) == -1 || fileStat.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return NULL;
+
+    *size = fileStat.st_size;
+    return data;
+}
+
+void unmapSnapshotFile(const void* data, size_t size) {
+    munmap((void*) data, size);
+}
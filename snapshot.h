@@ -0,0 +1,62 @@
+#ifndef CBATTLESHIPS_SNAPSHOT_H
+#define CBATTLESHIPS_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC "CBSSNAP"
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_RANDOM_STATE_SIZE 32
+
+/* Binary snapshot of a game: header, players, ship records, then points of reefs, of spy
+ * planes (in the order of ship records) and of fields shot at (in the order of players). Every field is a 32-bit integer or a byte array
+ * of size divisible by 4 in native byte order, so sections can be read in place. */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int32_t planeSizeY;
+    int32_t planeSizeX;
+    int32_t nextPlayerIndex;
+    int32_t extendedShips;
+    uint32_t randomSeed;
+    int32_t wasSeedGiven;
+    int32_t wasStateGiven;
+    char randomState[SNAPSHOT_RANDOM_STATE_SIZE];
+    int32_t shipsCount;
+    int32_t reefsCount;
+    int32_t spyPlanesCount;
+} SnapshotHeader;
+
+typedef struct {
+    int32_t typesCounts[4];
+    int32_t initArea[4];
+    int32_t hasShoot;
+    int32_t isAI;
+    int32_t shotsCount;
+} SnapshotPlayer;
+
+typedef struct {
+    int32_t playerIndex;
+    int32_t classIndex;
+    int32_t shipIndex;
+    int32_t headY;
+    int32_t headX;
+    int32_t direction;
+    int32_t isPlaced;
+    int32_t shots;
+    int32_t timesMoved;
+    int32_t shotThisTurn;
+    int32_t spyPlanesCount;
+} SnapshotShip;
+
+typedef struct {
+    int32_t y;
+    int32_t x;
+} SnapshotPoint;
+
+int writeSnapshotFile(const char* path, const void* data, size_t size);
+const void* mapSnapshotFile(const char* path, size_t* size);
+void unmapSnapshotFile(const void* data, size_t size);
+
+#endif //CBATTLESHIPS_SNAPSHOT_H
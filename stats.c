@@ -0,0 +1,78 @@
+#include "stats.h"
+
+#ifdef CBATTLESHIPS_STATS
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+typedef struct {
+    atomic_uint_fast64_t calls;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t totalNanos;
+    atomic_uint_fast64_t buckets[STATS_BUCKETS_COUNT];
+} StatsEntry;
+
+const char* statsKindNames[STATS_KINDS_COUNT] = {
+    "none", "placeShip", "shoot", "shootExtended", "moveShip", "placeSpy",
+    "playerPrint", "statePrint", "saveGame", "handleAI"
+};
+
+StatsEntry statsEntries[STATS_KINDS_COUNT];
+atomic_uint_fast64_t statsAllocations;
+atomic_uint_fast64_t statsAllocatedBytes;
+
+uint64_t getStatsNanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+void recordStatsCall(enum StatsKind kind, uint64_t nanos, int isError) {
+    StatsEntry* entry = &statsEntries[kind];
+    int bucket = nanos == 0 ? 0 : 63 - __builtin_clzll(nanos);
+    atomic_fetch_add_explicit(&entry->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&entry->errors, isError != 0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&entry->totalNanos, nanos, memory_order_relaxed);
+    atomic_fetch_add_explicit(&entry->buckets[bucket], 1, memory_order_relaxed);
+}
+
+void recordStatsAllocation(size_t bytes) {
+    atomic_fetch_add_explicit(&statsAllocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&statsAllocatedBytes, bytes, memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the percentile, so the result is exact up to a factor of 2
+uint64_t getStatsPercentile(StatsEntry* entry, uint64_t calls, int percent) {
+    uint64_t rank = (calls * percent + 99) / 100;
+    uint64_t seen = 0;
+    for(int bucket = 0; bucket < STATS_BUCKETS_COUNT - 1; bucket++) {
+        seen += atomic_load_explicit(&entry->buckets[bucket], memory_order_relaxed);
+        if(seen >= rank) return ((uint64_t) 2 << bucket) - 1;
+    }
+    return UINT64_MAX;
+}
+
+/* One line per kind of call and one for heap allocations of game state: arena blocks, fleets, board
+ * arenas, tiles and print frames. Every line ends with a new line. */
+void formatStats(char* text, size_t size) {
+    size_t length = 0;
+    for(int kind = STATS_NONE + 1; kind < STATS_KINDS_COUNT && length < size; kind++) {
+        StatsEntry* entry = &statsEntries[kind];
+        uint64_t calls = atomic_load_explicit(&entry->calls, memory_order_relaxed);
+        uint64_t errors = atomic_load_explicit(&entry->errors, memory_order_relaxed);
+        uint64_t totalNanos = atomic_load_explicit(&entry->totalNanos, memory_order_relaxed);
+        length += snprintf(text + length, size - length,
+                           "%s calls %llu errors %llu total_ns %llu p50_ns %llu p90_ns %llu p99_ns %llu\n",
+                           statsKindNames[kind], (unsigned long long) calls, (unsigned long long) errors,
+                           (unsigned long long) totalNanos,
+                           (unsigned long long) (calls ? getStatsPercentile(entry, calls, 50) : 0),
+                           (unsigned long long) (calls ? getStatsPercentile(entry, calls, 90) : 0),
+                           (unsigned long long) (calls ? getStatsPercentile(entry, calls, 99) : 0));
+    }
+    if(length < size) {
+        snprintf(text + length, size - length, "allocations count %llu bytes %llu\n",
+                 (unsigned long long) atomic_load_explicit(&statsAllocations, memory_order_relaxed),
+                 (unsigned long long) atomic_load_explicit(&statsAllocatedBytes, memory_order_relaxed));
+    }
+}
+#endif
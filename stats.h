@@ -0,0 +1,35 @@
+#ifndef CBATTLESHIPS_STATS_H
+#define CBATTLESHIPS_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATS_BUCKETS_COUNT 64
+#define STATS_TEXT_SIZE 4096
+
+enum StatsKind {
+    STATS_NONE, STATS_PLACE_SHIP, STATS_SHOOT, STATS_SHOOT_EXTENDED, STATS_MOVE_SHIP, STATS_PLACE_SPY,
+    STATS_PLAYER_PRINT, STATS_STATE_PRINT, STATS_SAVE_GAME, STATS_HANDLE_AI,
+    STATS_KINDS_COUNT
+};
+
+/* Counters exist only in builds with CBATTLESHIPS_STATS defined, otherwise the macros only take
+ * their arguments, so callers do not end with unused ones. Counters are shared by all games of the
+ * process and updated atomically, so shards of the server can count at the same time. Latency of
+ * a call goes to the bucket of its highest bit. */
+#ifdef CBATTLESHIPS_STATS
+uint64_t getStatsNanos();
+void recordStatsCall(enum StatsKind kind, uint64_t nanos, int isError);
+void recordStatsAllocation(size_t bytes);
+void formatStats(char* text, size_t size);
+
+#define STATS_START(start) uint64_t start = getStatsNanos()
+#define STATS_STOP(kind, start, isError) recordStatsCall(kind, getStatsNanos() - (start), isError)
+#define STATS_ALLOCATION(bytes) recordStatsAllocation(bytes)
+#else
+#define STATS_START(start)
+#define STATS_STOP(kind, start, isError) ((void) (kind), (void) (isError))
+#define STATS_ALLOCATION(bytes)
+#endif
+
+#endif //CBATTLESHIPS_STATS_H
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "strmap.h"
+
+#define STRING_MAP_MIN_SLOTS 16
+
+void initStringMap(StringMap* map) {
+    map->keys = NULL;
+    map->values = NULL;
+    map->length = 0;
+    map->capacity = 0;
+    map->slots = NULL;
+    map->slotsCount = 0;
+}
+
+// FNV-1a
+uint32_t hashString(const char* str) {
+    uint32_t hash = 2166136261u;
+    for(; *str != '\0'; str++) {
+        hash ^= (unsigned char) *str;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Returns slot holding the key or the empty slot where it should be inserted
+int findStringMapSlot(StringMap* map, const char* key) {
+    int mask = map->slotsCount - 1;
+    int slot = (int) (hashString(key) & mask);
+    while(map->slots[slot] != 0 && strcmp(map->keys[map->slots[slot] - 1], key) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void rehashStringMap(StringMap* map, int slotsCount) {
+    free(map->slots);
+    map->slotsCount = slotsCount;
+    map->slots = (int*) calloc(slotsCount, sizeof(int));
+    for(int entryI = 0; entryI < map->length; entryI++) {
+        map->slots[findStringMapSlot(map, map->keys[entryI])] = entryI + 1;
+    }
+}
+
+// Index of the entry with the key or -1 if there is no such entry
+int stringMapFind(StringMap* map, const char* key) {
+    if(map->length == 0) return -1;
+    return map->slots[findStringMapSlot(map, key)] - 1;
+}
+
+// Key is copied, it must not be in the map yet. Returns index of the new entry
+int stringMapAdd(StringMap* map, const char* key, void* value) {
+    if(map->length == map->capacity) {
+        map->capacity = map->capacity == 0 ? STRING_MAP_MIN_SLOTS / 2 : map->capacity * 2;
+        map->keys = (char**) realloc(map->keys, map->capacity * sizeof(char*));
+        map->values = (void**) realloc(map->values, map->capacity * sizeof(void*));
+    }
+    // Load factor is kept at most 1/2
+    if(2 * (map->length + 1) > map->slotsCount) {
+        rehashStringMap(map, map->slotsCount == 0 ? STRING_MAP_MIN_SLOTS : map->slotsCount * 2);
+    }
+
+    int entryI = map->length++;
+    size_t keySize = strlen(key) + 1;
+    map->keys[entryI] = (char*) malloc(keySize);
+    memcpy(map->keys[entryI], key, keySize);
+    map->values[entryI] = value;
+    map->slots[findStringMapSlot(map, key)] = entryI + 1;
+    return entryI;
+}
+
+// Values are not owned by the map, they have to be freed by the caller
+void freeStringMap(StringMap* map) {
+    for(int entryI = 0; entryI < map->length; entryI++) {
+        free(map->keys[entryI]);
+    }
+    free(map->keys);
+    free(map->values);
+    free(map->slots);
+    initStringMap(map);
+}
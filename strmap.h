@@ -0,0 +1,23 @@
+#ifndef CBATTLESHIPS_STRMAP_H
+#define CBATTLESHIPS_STRMAP_H
+
+#include <stdint.h>
+
+/* Hash map from strings to pointers. Entries are kept densely in insertion order
+ * (keys[i], values[i]), slots hold entry index + 1 or 0 for an empty slot. */
+typedef struct {
+    char** keys;
+    void** values;
+    int length;
+    int capacity;
+    int* slots;
+    int slotsCount;
+} StringMap;
+
+uint32_t hashString(const char* str);
+void initStringMap(StringMap* map);
+int stringMapFind(StringMap* map, const char* key);
+int stringMapAdd(StringMap* map, const char* key, void* value);
+void freeStringMap(StringMap* map);
+
+#endif //CBATTLESHIPS_STRMAP_H
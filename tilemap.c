@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tilemap.h"
+#include "stats.h"
+
+#define TILE_MAP_MIN_CAPACITY 16
+
+void initTileMap(TileMap* map, size_t tileSize, int fillByte) {
+    map->keys = NULL;
+    map->tiles = NULL;
+    map->count = 0;
+    map->capacity = 0;
+    map->tileSize = tileSize;
+    map->fillByte = fillByte;
+}
+
+uint64_t getTileKey(int tileY, int tileX) {
+    return ((uint64_t) (uint32_t) tileY << 32) | (uint32_t) tileX;
+}
+
+void getTileCoords(uint64_t key, int* tileY, int* tileX) {
+    *tileY = (int) (uint32_t) (key >> 32);
+    *tileX = (int) (uint32_t) key;
+}
+
+// Capacity is a power of 2, so the slot is taken from the highest bits of the mixed key
+int getTileSlot(TileMap* map, uint64_t key) {
+    uint64_t hash = key * 0x9e3779b97f4a7c15ULL;
+    return (int) ((hash >> 32) & (uint64_t) (map->capacity - 1));
+}
+
+// Returns slot holding the key or the empty slot where it would be added
+int findTileSlot(TileMap* map, uint64_t key) {
+    int slot = getTileSlot(map, key);
+    while(map->tiles[slot] != NULL && map->keys[slot] != key) {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return slot;
+}
+
+void* findTile(TileMap* map, int tileY, int tileX) {
+    if(map->count == 0) return NULL;
+    return map->tiles[findTileSlot(map, getTileKey(tileY, tileX))];
+}
+
+// Map is kept at most half full, so probes stay short
+void growTileMap(TileMap* map) {
+    uint64_t* oldKeys = map->keys;
+    void** oldTiles = map->tiles;
+    int oldCapacity = map->capacity;
+
+    map->capacity = oldCapacity == 0 ? TILE_MAP_MIN_CAPACITY : oldCapacity * 2;
+    map->keys = (uint64_t*) malloc(map->capacity * sizeof(uint64_t));
+    map->tiles = (void**) calloc(map->capacity, sizeof(void*));
+    STATS_ALLOCATION(map->capacity * (sizeof(uint64_t) + sizeof(void*)));
+    for(int slot = 0; slot < oldCapacity; slot++) {
+        if(oldTiles[slot] == NULL) continue;
+        int newSlot = findTileSlot(map, oldKeys[slot]);
+        map->keys[newSlot] = oldKeys[slot];
+        map->tiles[newSlot] = oldTiles[slot];
+    }
+    free(oldKeys);
+    free(oldTiles);
+}
+
+void* getOrAddTile(TileMap* map, int tileY, int tileX) {
+    if(2 * (map->count + 1) > map->capacity) growTileMap(map);
+
+    uint64_t key = getTileKey(tileY, tileX);
+    int slot = findTileSlot(map, key);
+    if(map->tiles[slot] == NULL) {
+        void* tile = malloc(map->tileSize);
+        STATS_ALLOCATION(map->tileSize);
+        memset(tile, map->fillByte, map->tileSize);
+        map->keys[slot] = key;
+        map->tiles[slot] = tile;
+        map->count++;
+    }
+    return map->tiles[slot];
+}
+
+// Dest gets its own copies of all tiles, whatever it held before is not freed
+void copyTileMap(TileMap* dest, TileMap* source) {
+    *dest = *source;
+    if(source->capacity == 0) return;
+
+    dest->keys = (uint64_t*) malloc(source->capacity * sizeof(uint64_t));
+    dest->tiles = (void**) calloc(source->capacity, sizeof(void*));
+    STATS_ALLOCATION(source->capacity * (sizeof(uint64_t) + sizeof(void*)));
+    memcpy(dest->keys, source->keys, source->capacity * sizeof(uint64_t));
+    for(int slot = 0; slot < source->capacity; slot++) {
+        if(source->tiles[slot] == NULL) continue;
+        dest->tiles[slot] = malloc(source->tileSize);
+        STATS_ALLOCATION(source->tileSize);
+        memcpy(dest->tiles[slot], source->tiles[slot], source->tileSize);
+    }
+}
+
+// Frees all tiles, map stays usable
+void clearTileMap(TileMap* map) {
+    for(int slot = 0; slot < map->capacity; slot++) {
+        free(map->tiles[slot]);
+    }
+    free(map->keys);
+    free(map->tiles);
+    initTileMap(map, map->tileSize, map->fillByte);
+}
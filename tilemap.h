@@ -0,0 +1,30 @@
+#ifndef CBATTLESHIPS_TILEMAP_H
+#define CBATTLESHIPS_TILEMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILE_SIDE 64
+#define TILE_FIELDS (TILE_SIDE * TILE_SIDE)
+
+/* Hash map from coordinates of a tile (TILE_SIDE x TILE_SIDE fields) to its data of tileSize bytes.
+ * Tiles are created on the first write, filled with fillByte, and kept until the map is cleared,
+ * so memory follows the part of the plane that was written to. Slot i holds tiles[i] with key keys[i]
+ * or NULL, so all tiles can be visited by going through the slots. */
+typedef struct {
+    uint64_t* keys;
+    void** tiles;
+    int count;
+    int capacity;
+    size_t tileSize;
+    int fillByte;
+} TileMap;
+
+void initTileMap(TileMap* map, size_t tileSize, int fillByte);
+void* findTile(TileMap* map, int tileY, int tileX);
+void* getOrAddTile(TileMap* map, int tileY, int tileX);
+void getTileCoords(uint64_t key, int* tileY, int* tileX);
+void copyTileMap(TileMap* dest, TileMap* source);
+void clearTileMap(TileMap* map);
+
+#endif //CBATTLESHIPS_TILEMAP_H
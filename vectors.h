@@ -5,70 +5,111 @@
 #ifndef CBATTLESHIPS_VECTORS_H
 #define CBATTLESHIPS_VECTORS_H
 
+#include "arena.h"
+
+#define MAX_SPY_PLANES 5
+
+/* Vectors are generated by macros, DECLARE_VEC goes to a header and DEFINE_VEC to a source file.
+ * Growth is amortised, capacity is only halved once the length drops to a quarter of it, so pushes
+ * and pops around a boundary do not reallocate. Vector created in an arena takes its buffers from
+ * the arena and never frees them. */
+#define VEC_MIN_CAPACITY 8
+
+#define DECLARE_VEC(Name, T, prefix) \
+    typedef struct { \
+        int capacity; \
+        int length; \
+        T* ptr; \
+        Arena* arena; \
+    } Name; \
+    void init##Name(Name* vec); \
+    void init##Name##InArena(Name* vec, Arena* arena); \
+    void prefix##Reserve(Name* vec, int capacity); \
+    void prefix##PushBack(Name* vec, T element); \
+    void prefix##PopBack(Name* vec); \
+    void prefix##ShrinkIfNeeded(Name* vec); \
+    void prefix##Clear(Name* vec); \
+    void free##Name(Name* vec);
+
+// Source file using DEFINE_VEC has to include stdlib.h and string.h
+#define DEFINE_VEC(Name, T, prefix) \
+    void init##Name(Name* vec) { \
+        vec->capacity = 0; \
+        vec->length = 0; \
+        vec->ptr = NULL; \
+        vec->arena = NULL; \
+    } \
+    \
+    void init##Name##InArena(Name* vec, Arena* arena) { \
+        init##Name(vec); \
+        vec->arena = arena; \
+    } \
+    \
+    /* Capacity at least doubles, so a series of pushes is amortised O(1) */ \
+    void prefix##Reserve(Name* vec, int capacity) { \
+        if(capacity <= vec->capacity) return; \
+        int newCapacity = vec->capacity * 2; \
+        if(newCapacity < capacity) newCapacity = capacity; \
+        if(newCapacity < VEC_MIN_CAPACITY) newCapacity = VEC_MIN_CAPACITY; \
+        if(vec->arena != NULL) { \
+            T* newPtr = (T*) arenaAlloc(vec->arena, newCapacity * sizeof(T)); \
+            if(vec->length > 0) memcpy(newPtr, vec->ptr, vec->length * sizeof(T)); \
+            vec->ptr = newPtr; \
+        } else { \
+            vec->ptr = (T*) realloc(vec->ptr, newCapacity * sizeof(T)); \
+        } \
+        vec->capacity = newCapacity; \
+    } \
+    \
+    void prefix##PushBack(Name* vec, T element) { \
+        if(vec->length == vec->capacity) prefix##Reserve(vec, vec->length + 1); \
+        vec->ptr[vec->length++] = element; \
+    } \
+    \
+    void prefix##PopBack(Name* vec) { \
+        vec->length--; \
+        prefix##ShrinkIfNeeded(vec); \
+    } \
+    \
+    void prefix##ShrinkIfNeeded(Name* vec) { \
+        if(vec->arena != NULL || vec->capacity <= VEC_MIN_CAPACITY) return; \
+        if(vec->length > vec->capacity / 4) return; \
+        vec->capacity /= 2; \
+        vec->ptr = (T*) realloc(vec->ptr, vec->capacity * sizeof(T)); \
+    } \
+    \
+    /* Buffer is kept for the elements pushed next */ \
+    void prefix##Clear(Name* vec) { \
+        vec->length = 0; \
+    } \
+    \
+    void free##Name(Name* vec) { \
+        if(vec->arena == NULL) free(vec->ptr); \
+        init##Name##InArena(vec, vec->arena); \
+    }
+
+// Iterates in place, it points to the current element
+#define VEC_FOR_EACH(T, it, vec) for(T* it = (vec)->ptr; it < (vec)->ptr + (vec)->length; it++)
+
 typedef struct {
     int x;
     int y;
 } Point;
 
-typedef struct {
-    int capacity;
-    int length;
-    Point* ptr;
-} PointVec;
-
 enum Direction {
     N='N', W='W', S='S', E='E'
 };
 
+/* Ships are kept in columns of the fleet of their player, this is a copy of the fields rules check
+ * the geometry with. ID is the dense id of the ship in the fleet, spy planes point into the fleet. */
 typedef struct {
     Point headPos;
     enum Direction direction;
     char shots;
-    int isPlaced;
     int size;
-    int timesMoved;
-    int shotThisTurn;
-    PointVec spyPlanes;
     int ID;
+    const Point* spyPlanes;
+    int spyPlanesCount;
 } Ship;
 
-typedef struct {
-    int capacity;
-    int length;
-    Ship** ptr;
-} ShipVec;
-
-typedef struct {
-    Point pos;
-    int nth;
-    Ship* ship;
-} ShipElement;
-
-typedef struct {
-    int capacity;
-    int length;
-    ShipElement* ptr;
-} ShipElementVec;
-
-void initPointVec(PointVec* newPointVec);
-void pointVecEnlargeIfNeeded(PointVec* vec);
-void pointVecPushBack(PointVec* vec, Point p);
-void pointVecShrinkIfNeeded(PointVec* vec);
-void pointVecPopBack(PointVec* vec);
-void pointVecReset(PointVec* vec);
-
-void initShipVec(ShipVec* newShipVec);
-void shipVecEnlargeIfNeeded(ShipVec* vec);
-void shipVecPushBack(ShipVec* vec, Ship* s);
-void shipVecShrinkIfNeeded(ShipVec* vec);
-void shipVecPopBack(ShipVec* vec);
-void shipVecReset(ShipVec* vec);
-
-void initShipElementVec(ShipElementVec* newShipElementVec);
-void shipElementVecEnlargeIfNeeded(ShipElementVec* vec);
-void shipElementVecPushBack(ShipElementVec* vec, ShipElement s);
-void shipElementVecShrinkIfNeeded(ShipElementVec* vec);
-void shipElementVecPopBack(ShipElementVec* vec);
-void shipElementVecReset(ShipElementVec* vec);
-
 #endif //CBATTLESHIPS_VECTORS_H